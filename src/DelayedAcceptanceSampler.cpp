@@ -0,0 +1,160 @@
+#include <DelayedAcceptanceSampler.H>
+#include <Rand.H>
+#include <Utility.H>
+
+#include <cmath>
+#include <limits>
+
+DelayedAcceptanceSampler::DelayedAcceptanceSampler(int _ndim, int _nwalkers, LogProbBatch _log_prob,
+                                                   const std::vector<Real>& _proposal_std,
+                                                   const GPSurrogate& _surrogate,
+                                                   uint64_t _seed)
+  : MCMCSampler(_ndim,_nwalkers,_log_prob,_seed),
+    proposal_std(_proposal_std), surrogate(_surrogate), screen_log_prob(0),
+    logq(_nwalkers), nevaluated(0), adapt_steps(-1)
+{
+  BL_ASSERT(proposal_std.size() == ndim);
+  BL_ASSERT(surrogate.NumDim() == ndim);
+}
+
+// The surrogate is not used, and is left empty
+DelayedAcceptanceSampler::DelayedAcceptanceSampler(int _ndim, int _nwalkers, LogProbBatch _log_prob,
+                                                   const std::vector<Real>& _proposal_std,
+                                                   LogProbBatch _screen_log_prob,
+                                                   uint64_t _seed)
+  : MCMCSampler(_ndim,_nwalkers,_log_prob,_seed),
+    proposal_std(_proposal_std), surrogate(std::vector<Real>(_ndim,1),2),
+    screen_log_prob(_screen_log_prob), logq(_nwalkers), nevaluated(0), adapt_steps(-1)
+{
+  BL_ASSERT(proposal_std.size() == ndim);
+  BL_ASSERT(screen_log_prob != 0);
+}
+
+void
+DelayedAcceptanceSampler::SetEnsemble(const std::vector<Real>& _x, int _step)
+{
+  MCMCSampler::SetEnsemble(_x,_step);
+  if (screen_log_prob) {
+    EvaluateBatch(x,nwalkers,&(logq[0]),screen_log_prob);
+  }
+  else if (Adapting()) {
+    AddToSurrogate(&(x[0]),&(logp[0]),nwalkers);
+  }
+}
+
+std::string
+DelayedAcceptanceSampler::State() const
+{
+  std::string state = MCMCSampler::State();
+  if (!screen_log_prob) {
+    state += "\n" + surrogate.State();
+  }
+  return state;
+}
+
+// The surrogate of the checkpoint replaces the one SetEnsemble builds
+// up from the walker positions
+void
+DelayedAcceptanceSampler::Restart(const std::string& state, const std::vector<Real>& _x)
+{
+  size_t eol = state.find('\n');
+  MCMCSampler::Restart(state.substr(0,eol),_x);
+  if (!screen_log_prob) {
+    if (eol == std::string::npos) {
+      BoxLib::Abort("DelayedAcceptanceSampler: checkpoint has no surrogate state");
+    }
+    surrogate.SetState(state.substr(eol+1));
+  }
+}
+
+// Failed evaluations carry no information about the shape of the
+// log probability, and are not added
+void
+DelayedAcceptanceSampler::AddToSurrogate(const Real* y, const Real* lp, int n)
+{
+  for (int i=0; i<n; ++i) {
+    if (lp[i] > -std::numeric_limits<Real>::infinity()) {
+      surrogate.Add(&(y[i*ndim]),lp[i]);
+    }
+  }
+}
+
+void
+DelayedAcceptanceSampler::Run(int nsteps, std::vector<Real>& chain)
+{
+  chain.resize((size_t)nwalkers*nsteps*ndim);
+  naccepted = 0;
+  nproposed = 0;
+  nevaluated = 0;
+
+  std::vector<Real> y(nwalkers*ndim), ds(nwalkers), lpy(nwalkers), lqy(nwalkers);
+  std::vector<int> passed(nwalkers);
+
+  for (int t=0; t<nsteps; ++t, ++step) {
+    // Propose, and screen with the surrogate or the cheap model
+    std::vector<RandStream> rs(nwalkers);
+    for (int k=0; k<nwalkers; ++k) {
+      rs[k].Reset(seed,(uint64_t)step*nwalkers + k,RAND_TAG_MCMC);
+      Real* yk = &(y[k*ndim]);
+      rs[k].FillNormal(yk,ndim);
+      for (int d=0; d<ndim; ++d) {
+        yk[d] = x[k*ndim + d] + proposal_std[d]*yk[d];
+      }
+      if (!screen_log_prob) {
+        ds[k] = surrogate(yk) - surrogate(&(x[k*ndim]));
+      }
+    }
+    if (screen_log_prob) {
+      EvaluateBatch(y,nwalkers,&(lqy[0]),screen_log_prob);
+      for (int k=0; k<nwalkers; ++k) {
+        ds[k] = lqy[k] - logq[k];
+      }
+    }
+    for (int k=0; k<nwalkers; ++k) {
+      passed[k] = (std::log(rs[k].drand()) < ds[k]);
+    }
+
+    // Evaluate the proposals that passed in one batch
+    std::vector<int> idx;
+    for (int k=0; k<nwalkers; ++k) {
+      if (passed[k]) {
+        idx.push_back(k);
+      }
+    }
+    int npassed = idx.size();
+    std::vector<Real> z(npassed*ndim);
+    for (int i=0; i<npassed; ++i) {
+      for (int d=0; d<ndim; ++d) {
+        z[i*ndim + d] = y[idx[i]*ndim + d];
+      }
+    }
+    EvaluateBatch(z,npassed,&(lpy[0]));
+
+    for (int i=0; i<npassed; ++i) {
+      int k = idx[i];
+      Real log_accept = lpy[i] - logp[k] - ds[k];
+      if (lpy[i] > -std::numeric_limits<Real>::infinity()
+          && std::log(rs[k].drand()) < log_accept) {
+        for (int d=0; d<ndim; ++d) {
+          x[k*ndim + d] = z[i*ndim + d];
+        }
+        logp[k] = lpy[i];
+        logq[k] = lqy[k];
+        naccepted++;
+      }
+    }
+    if (npassed > 0 && !screen_log_prob && Adapting()) {
+      AddToSurrogate(&(z[0]),&(lpy[0]),npassed);
+    }
+    nevaluated += npassed;
+    nproposed += nwalkers;
+
+    StoreEnsemble(t,nsteps,chain);
+  }
+}
+
+Real
+DelayedAcceptanceSampler::EvaluatedFraction() const
+{
+  return (nproposed > 0 ? Real(nevaluated) / nproposed : 0);
+}
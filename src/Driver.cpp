@@ -4,18 +4,22 @@
 
 #include <ParmParse.H>
 #include <Utility.H>
+#include <BoxLib.H>
 #include <ChemDriver.H>
 #include <cminpack.h>
 #include <stdio.h>
 #include <lapacke.h>
 
 #include <Driver.H>
+#include <Tracer.H>
 
 #ifdef _OPENMP
 #include "omp.h"
 #endif
 
 static bool made_cd = false;
+static bool profile_written = false;
+static bool trace_written = false;
 ChemDriver *Driver::cd = 0;
 MINPACKstruct *Driver::mystruct = 0;
 Real Driver::param_eps = 1.e-4;
@@ -156,6 +160,29 @@ double Driver::LogLikelihood(const std::vector<double>& parameters)
   return -funcF((void*)(Driver::mystruct),parameters);
 }
 
+void Driver::LogLikelihoodBatch(const double* parameters, int nsamples, double* logL)
+{
+  // The samples go one at a time: an evaluation sets the rate
+  // parameters of the one ChemDriver and fills the buffers of the
+  // shared experiments, so only the experiments of a sample can run
+  // concurrently (over threads, or over the ranks of a group)
+  int num_params = NumParams();
+  for (int i=0; i<nsamples; ++i) {
+    const double* x = parameters + (size_t)i * num_params;
+    logL[i] = -funcF((void*)(Driver::mystruct),std::vector<double>(x, x + num_params));
+  }
+}
+
+void Driver::SetFidelity(int level)
+{
+  Driver::mystruct->expt_manager.SetFidelity(level);
+}
+
+int Driver::NumFidelityLevels()
+{
+  return Driver::mystruct->expt_manager.NumFidelityLevels();
+}
+
 double Driver::VerboseLogLikelihood(const std::vector<Real>& pvals,
 				    std::vector<Real>&       dvals,
 				    std::vector<Real>&       svals,
@@ -179,6 +206,95 @@ int Driver::NumData()
   return Driver::mystruct->expt_manager.NumExptData();
 }
 
+std::vector<std::string>
+Driver::ExperimentNames()
+{
+  return Driver::mystruct->expt_manager.ExperimentNames();
+}
+
+std::vector<std::string>
+Driver::ExperimentCounterNames()
+{
+  std::vector<std::string> names;
+  for (int c=0; c<ExperimentManager::NUM_PROFILE_COUNTERS; ++c) {
+    names.push_back(ExperimentManager::ProfileCounterName(c));
+  }
+  return names;
+}
+
+std::vector<double>
+Driver::ExperimentCounters(const std::string& counter)
+{
+  const ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  int c = 0;
+  while (c < ExperimentManager::NUM_PROFILE_COUNTERS
+         && ExperimentManager::ProfileCounterName(c) != counter) {
+    ++c;
+  }
+  if (c == ExperimentManager::NUM_PROFILE_COUNTERS) {
+    BoxLib::Abort("Driver::ExperimentCounters: unknown counter " + counter);
+  }
+  std::vector<double> values(expt_manager.size());
+  for (int i=0; i<values.size(); ++i) {
+    values[i] = expt_manager.ProfileCounter(i,c);
+  }
+  return values;
+}
+
+std::vector<double>
+Driver::ExperimentFailures(const std::string& error)
+{
+  const ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  int errID = SimulatedExperiment::ErrorID(error);
+  if (errID < 0) {
+    BoxLib::Abort("Driver::ExperimentFailures: unknown error " + error);
+  }
+  std::vector<double> values(expt_manager.size());
+  for (int i=0; i<values.size(); ++i) {
+    values[i] = expt_manager.ProfileFailures(i,errID);
+  }
+  return values;
+}
+
+void
+Driver::ResetExperimentCounters()
+{
+  Driver::mystruct->expt_manager.ResetProfile();
+}
+
+void
+Driver::WriteExperimentProfile()
+{
+  if (Driver::mystruct != 0) {
+    Driver::mystruct->expt_manager.WriteProfile();
+    profile_written = true;
+  }
+}
+
+// The profile and the trace are written at BoxLib::Finalize, or, when
+// the caller owns MPI and never finalizes BoxLib, by ~Driver
+static void
+WriteReportsAtExit()
+{
+  if (profile_written && trace_written) {
+    return;
+  }
+#ifdef BL_USE_MPI
+  int finalized = 0;
+  MPI_Finalized(&finalized);
+  if (finalized) {
+    return;
+  }
+#endif
+  if (!profile_written) {
+    Driver::WriteExperimentProfile();
+  }
+  if (!trace_written) {
+    Tracer::Write();
+    trace_written = true;
+  }
+}
+
 std::vector<double>
 Driver::PriorMean()
 {
@@ -325,10 +441,16 @@ Driver::init(int argc, char *argv[])
 
     ParmParse pp;
     param_eps = 1.e-4; pp.query("param_eps",param_eps);
+    int rand_seed = 0; pp.query("rand_seed",rand_seed);
+    SetRandSeed(rand_seed);
     bool use_synthetic_data = false; pp.query("use_synthetic_data",use_synthetic_data);
     if (ParallelDescriptor::IOProcessor() && use_synthetic_data) {
       std::cout << "*************  Using sythetic data " << std::endl;
     }
+    std::string trace_file; pp.query("trace_file",trace_file);
+    if (trace_file != "") {
+      Tracer::Enable(trace_file);
+    }
     mystruct = new MINPACKstruct(*cd,param_eps,use_synthetic_data);
 
     ParameterManager& parameter_manager = mystruct->parameter_manager;
@@ -342,6 +464,7 @@ Driver::init(int argc, char *argv[])
     expt_manager.InitializeExperiments();
     expt_manager.InitializeTrueData(parameter_manager.TrueParameters());
     expt_manager.GenerateExptData(); // Create perturbed experimental data (stored internally)
+    BoxLib::ExecOnFinalize(WriteReportsAtExit);
 
 #if 0
         std::cout << "Running 1 set of experiments" << std::endl;
@@ -389,6 +512,7 @@ Driver::SetNumThreads(int num_threads)
 
 Driver::~Driver()
 {
+  WriteReportsAtExit();
   delete mystruct;
   if (made_cd) delete cd;
   if( mpi_initialized ){
@@ -0,0 +1,180 @@
+#include <EnsembleSampler.H>
+#include <Rand.H>
+#include <ParallelDescriptor.H>
+#include <ParallelGroups.H>
+#include <Tracer.H>
+#include <Utility.H>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+MCMCSampler::MCMCSampler(int _ndim, int _nwalkers, LogProbBatch _log_prob, uint64_t _seed)
+  : ndim(_ndim), nwalkers(_nwalkers), log_prob(_log_prob),
+    seed(_seed), step(0), x(_ndim*_nwalkers), logp(_nwalkers),
+    naccepted(0), nproposed(0)
+{}
+
+void
+MCMCSampler::SetEnsemble(const std::vector<Real>& _x, int _step)
+{
+  BL_ASSERT(_x.size() == x.size());
+  x = _x;
+  step = _step;
+  EvaluateBatch(x,nwalkers,&(logp[0]));
+}
+
+// Evaluate the log probabilities of n points, each group of ranks
+// taking a contiguous part of the batch
+void
+MCMCSampler::EvaluateBatch(const std::vector<Real>& y, int n, Real* lp,
+                           LogProbBatch f) const
+{
+  if (n == 0) {
+    return;
+  }
+  if (f == 0) {
+    f = log_prob;
+  }
+
+  int ngroups = ParallelGroups::NGroups();
+  if (ngroups == 1) {
+    TraceScope trace("log_prob","sampler");
+    f(&(y[0]),n,lp);
+    return;
+  }
+
+  int mygroup = ParallelGroups::MyGroup();
+  int begin = (n*mygroup) / ngroups;
+  int end = (n*(mygroup+1)) / ngroups;
+  std::vector<Real> part(n,0);
+  if (end > begin) {
+    TraceScope trace("log_prob","sampler");
+    f(&(y[(size_t)begin*ndim]),end-begin,&(part[begin]));
+  }
+  {
+    TraceScope trace("reduce log_prob","mpi");
+    ParallelGroups::ReduceRealSumOverGroups(&(part[0]),n);
+  }
+  for (int i=0; i<n; ++i) {
+    lp[i] = part[i];
+  }
+}
+
+void
+MCMCSampler::StoreEnsemble(int t, int nsteps, std::vector<Real>& chain) const
+{
+  for (int k=0; k<nwalkers; ++k) {
+    for (int d=0; d<ndim; ++d) {
+      chain[k + (size_t)nwalkers*t + (size_t)nwalkers*nsteps*d] = x[k*ndim + d];
+    }
+  }
+}
+
+Real
+MCMCSampler::AcceptanceFraction() const
+{
+  return (nproposed > 0 ? Real(naccepted) / nproposed : 0);
+}
+
+std::string
+MCMCSampler::State() const
+{
+  RandStream rs(seed,(uint64_t)step*nwalkers,RAND_TAG_MCMC);
+  return rs.State();
+}
+
+void
+MCMCSampler::Restart(const std::string& state, const std::vector<Real>& _x)
+{
+  RandStream rs;
+  rs.SetState(state);
+  if (rs.Stream() % nwalkers != 0) {
+    BoxLib::Abort("MCMCSampler: random state does not match the number of walkers");
+  }
+  seed = rs.Seed();
+  SetEnsemble(_x,rs.Stream() / nwalkers);
+}
+
+EnsembleSampler::EnsembleSampler(int _ndim, int _nwalkers, LogProbBatch _log_prob,
+                                 Real _a, Real _de_fraction, uint64_t _seed)
+  : MCMCSampler(_ndim,_nwalkers,_log_prob,_seed),
+    a(_a), de_fraction(_de_fraction)
+{
+  if (nwalkers < 4 || nwalkers % 2 != 0) {
+    BoxLib::Abort("EnsembleSampler: need an even number of walkers, at least 4");
+  }
+  if (a <= 1) {
+    BoxLib::Abort("EnsembleSampler: stretch scale must be larger than 1");
+  }
+  de_gamma = 2.38 / std::sqrt(2.0*ndim);
+}
+
+void
+EnsembleSampler::Run(int nsteps, std::vector<Real>& chain)
+{
+  chain.resize((size_t)nwalkers*nsteps*ndim);
+  naccepted = 0;
+  nproposed = 0;
+
+  int nhalf = nwalkers / 2;
+  std::vector<Real> y(nhalf*ndim), lpy(nhalf), log_ratio(nhalf);
+
+  for (int t=0; t<nsteps; ++t, ++step) {
+    for (int half=0; half<2; ++half) {
+      int first = half*nhalf;            // Walkers that move
+      int other = (1-half)*nhalf;        // Walkers they move with
+
+      std::vector<RandStream> rs(nhalf);
+      for (int i=0; i<nhalf; ++i) {
+        int k = first + i;
+        rs[i].Reset(seed,(uint64_t)step*nwalkers + k,RAND_TAG_MCMC);
+        const Real* xk = &(x[k*ndim]);
+        Real* yi = &(y[i*ndim]);
+
+        if (rs[i].drand() < de_fraction) {
+          // Differential evolution: y = x + gamma (x_j1 - x_j2)
+          int j1 = std::min(int(rs[i].drand()*nhalf), nhalf-1);
+          int j2 = std::min(int(rs[i].drand()*(nhalf-1)), nhalf-2);
+          if (j2 >= j1) j2++;
+          const Real* x1 = &(x[(other+j1)*ndim]);
+          const Real* x2 = &(x[(other+j2)*ndim]);
+          Real gamma = de_gamma * (1 + 1.e-4*rs[i].randn());
+          for (int d=0; d<ndim; ++d) {
+            yi[d] = xk[d] + gamma*(x1[d] - x2[d]);
+          }
+          log_ratio[i] = 0;
+        }
+        else {
+          // Stretch: y = x_j + z (x - x_j), z ~ 1/sqrt(z) on [1/a,a]
+          int j = std::min(int(rs[i].drand()*nhalf), nhalf-1);
+          const Real* xj = &(x[(other+j)*ndim]);
+          Real s = (a - 1)*rs[i].drand() + 1;
+          Real z = s*s / a;
+          for (int d=0; d<ndim; ++d) {
+            yi[d] = xj[d] + z*(xk[d] - xj[d]);
+          }
+          log_ratio[i] = (ndim - 1)*std::log(z);
+        }
+      }
+
+      EvaluateBatch(y,nhalf,&(lpy[0]));
+
+      for (int i=0; i<nhalf; ++i) {
+        int k = first + i;
+        Real log_accept = log_ratio[i] + lpy[i] - logp[k];
+        if (lpy[i] > -std::numeric_limits<Real>::infinity()
+            && std::log(rs[i].drand()) < log_accept) {
+          for (int d=0; d<ndim; ++d) {
+            x[k*ndim + d] = y[i*ndim + d];
+          }
+          logp[k] = lpy[i];
+          naccepted++;
+        }
+      }
+      nproposed += nhalf;
+    }
+
+    StoreEnsemble(t,nsteps,chain);
+  }
+}
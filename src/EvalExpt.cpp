@@ -3,11 +3,218 @@
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 
 #include <Utility.H>
 #include <ParmParse.H>
 #include <UqPlotfile.H>
 
+// With TESTDATA, the samples are made up (component j is j) and so are
+// the results (F is the sampleID, datum j is j), to check the
+// distribution and the output files without a sample file or any
+// chemistry
+#define TESTDATA
+#undef TESTDATA
+
+// Progress file: a header of ProgressVersion, iter, iters, nwalkers,
+// ndim and nD (ints), a 64-bit hash of the samples, the length of the
+// sample file name (int) and the name, then a record per evaluated
+// sample, appended as the results come in: the sample ID, F and, if
+// writeExptData, the nD = nData simulated data (doubles).  A record
+// cut short by a killed job is ignored.  The file is removed once
+// Ffile and Dfile are written.
+static const int ProgressVersion = 2;
+
+// 64-bit FNV-1a hash of n bytes
+static unsigned long long
+HashBytes(const void* p, size_t n)
+{
+  const unsigned char* c = static_cast<const unsigned char*>(p);
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i=0; i<n; ++i) {
+    h ^= c[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static std::string
+ProgressHeader(const int shape[6], const std::vector<Real>& samples,
+               const std::string& sampleFile)
+{
+  unsigned long long hash = HashBytes(&(samples[0]),samples.size()*sizeof(Real));
+  int len = sampleFile.size();
+  std::string header(reinterpret_cast<const char*>(shape),6*sizeof(int));
+  header.append(reinterpret_cast<const char*>(&hash),sizeof(hash));
+  header.append(reinterpret_cast<const char*>(&len),sizeof(int));
+  return header + sampleFile;
+}
+
+static void
+InitProgress(const std::string& filename, const std::string& header, int nD,
+             std::vector<Real>& F, std::vector<Real>& D, std::vector<bool>& done)
+{
+  int nsamples = F.size();
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (ifs.good()) {
+    std::vector<char> file_header(header.size());
+    ifs.read(&(file_header[0]),file_header.size());
+    if (ifs.gcount() == (std::streamsize) header.size()) {
+      if (std::memcmp(&(file_header[0]),header.data(),header.size()) != 0) {
+        BoxLib::Abort("EvalExpt: progressFile " + filename + " is for other samples; remove it to start over");
+      }
+      std::vector<double> rec(2 + nD);
+      int nread = 0;
+      size_t nrecs = 0;
+      while (ifs.read(reinterpret_cast<char*>(&(rec[0])),rec.size()*sizeof(double))) {
+        int sampleID = (int) rec[0];
+        if (sampleID < 0 || sampleID >= nsamples) {
+          BoxLib::Abort("EvalExpt: corrupt progressFile " + filename);
+        }
+        F[sampleID] = rec[1];
+        for (int j=0; j<nD; ++j) {
+          D[sampleID + (size_t)nsamples*j] = rec[2+j];
+        }
+        nrecs++;
+        if (!done[sampleID]) {
+          done[sampleID] = true;
+          nread++;
+        }
+      }
+      std::cout << "Restarting from " << filename << ": " << nread << " of "
+                << nsamples << " samples already evaluated" << std::endl;
+      ifs.close();
+
+      // Drop a trailing partial record, so that appends stay aligned
+      std::vector<char> keep;
+      std::ifstream ifk(filename.c_str(), std::ios::binary);
+      size_t len = header.size() + nrecs * rec.size() * sizeof(double);
+      keep.resize(len);
+      ifk.read(&(keep[0]),len);
+      ifk.close();
+      std::ofstream ofs(filename.c_str(), std::ios::binary | std::ios::trunc);
+      ofs.write(&(keep[0]),len);
+      return;
+    }
+  }
+  std::ofstream ofs(filename.c_str(), std::ios::binary | std::ios::trunc);
+  ofs.write(header.data(),header.size());
+  if (!ofs.good()) {
+    BoxLib::FileOpenFailed(filename);
+  }
+}
+
+// Store results, laid out as records of the progress file, and append
+// them to it
+static void
+StoreResults(const double* recs, int n, int nD, std::vector<Real>& F,
+             std::vector<Real>& D, std::vector<bool>& done, std::ofstream& progress)
+{
+  int nsamples = F.size();
+  for (int i=0; i<n; ++i) {
+    const double* rec = recs + (size_t)i*(2+nD);
+    int sampleID = (int) rec[0];
+    F[sampleID] = rec[1];
+    for (int j=0; j<nD; ++j) {
+      D[sampleID + (size_t)nsamples*j] = rec[2+j];
+    }
+    done[sampleID] = true;
+  }
+  progress.write(reinterpret_cast<const char*>(recs),(size_t)n*(2+nD)*sizeof(double));
+  progress.flush();
+  if (!progress.good()) {
+    BoxLib::Abort("EvalExpt: failed to write the progress file");
+  }
+}
+
+// Take the next chunk of at most chunkSize samples off todo: their
+// sampleIDs, followed by their parameters (ndim per sample)
+static int
+NextChunk(std::deque<int>& todo, int chunkSize, const std::vector<Real>& samples,
+          int nsamples, int ndim, std::vector<double>& chunk)
+{
+  int n = std::min(chunkSize,(int)todo.size());
+  chunk.resize((size_t)n*(1+ndim));
+  for (int i=0; i<n; ++i) {
+    int sampleID = todo.front();
+    todo.pop_front();
+    chunk[i] = sampleID;
+    for (int j=0; j<ndim; ++j) {
+      chunk[n + (size_t)i*ndim + j] = samples[sampleID + (size_t)nsamples*j];
+    }
+  }
+  return n;
+}
+
+// Evaluate the samples of a chunk, sampleIDs followed by their
+// parameters (ndim per sample), into progress file records
+static void
+EvaluateChunk(Driver& driver, const std::vector<double>& chunk, int n, int ndim, int nD,
+              const std::string& diagnostic_prefix, int nDigits, bool verbose,
+              std::vector<double>& recs)
+{
+  ExperimentManager& expt_manager = driver.mystruct->expt_manager;
+  int nData = driver.NumData();
+  std::vector<Real> svals(nData);
+  std::vector<Real> dvals(nData);
+  Real Fa, Fb;
+
+  recs.resize((size_t)n*(2+nD));
+  for (int i=0; i<n; ++i) {
+    int sampleID = (int) chunk[i];
+    std::vector<Real> mySamples(&(chunk[n + (size_t)i*ndim]), &(chunk[n + (size_t)(i+1)*ndim]));
+    double* rec = &(recs[(size_t)i*(2+nD)]);
+
+    std::string my_prefix = BoxLib::Concatenate(diagnostic_prefix,sampleID,nDigits) + "/";
+    expt_manager.SetDiagnosticPrefix(my_prefix);
+
+    rec[0] = sampleID;
+#ifndef TESTDATA
+    rec[1] = driver.VerboseLogLikelihood(mySamples,dvals,svals,Fa,Fb);
+#else
+    rec[1] = sampleID;
+#endif
+    for (int j=0; j<nD; ++j) {
+#ifndef TESTDATA
+      rec[2+j] = dvals[j];
+#else
+      rec[2+j] = j;
+#endif
+    }
+
+    if (verbose) {
+      std::cout << sampleID << " [";
+      for (int j=0; j<ndim; ++j) {
+        std::cout << "  " << mySamples[j];
+        if (j<ndim-1) std::cout << " ";
+      }
+      std::cout << "] F = " << rec[1];
+      if (nD > 0) {
+        std::cout << " D = [";
+        for (int j=0; j<nD; ++j) {
+          std::cout << "  " << rec[2+j];
+          if (j<nD-1) std::cout << " ";
+        }
+        std::cout << " ]";
+      }
+      std::cout << std::endl;
+    }
+  }
+}
+
+// Evaluate F (and, with writeExptData, the simulated data D) at the
+// samples of sampleFile, into the plotfiles Ffile and Dfile.
+//
+// The IO rank reads the samples and hands them out in chunks of
+// chunkSize samples to the other ranks as they become free, and alone
+// gathers the results (with one rank, it evaluates them itself).
+// Each result is appended to progressFile (default Ffile.progress) as
+// it comes in; a rerun with the same progressFile and samples skips
+// the samples already evaluated.  The progressFile is removed once
+// Ffile and Dfile are written.
 int
 main (int   argc,
       char* argv[])
@@ -26,7 +233,6 @@ main (int   argc,
   expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_THREAD);
 
   int nprocs = ParallelDescriptor::NProcs();
-  int myproc = ParallelDescriptor::MyProc();
   bool ioproc = ParallelDescriptor::IOProcessor();
 
 
@@ -38,13 +244,17 @@ main (int   argc,
   pp.query("diagnostic_prefix",diagnostic_prefix);
 
   bool writeExptData = false; pp.query("writeExptData",writeExptData);
-
-#define TESTDATA
-#undef TESTDATA
+  std::string Ffile = "Ffile"; pp.query("Ffile",Ffile);
+  std::string Dfile = "Dfile"; pp.query("Dfile",Dfile);
+  std::string progressFile = Ffile + ".progress"; pp.query("progressFile",progressFile);
+  int chunkSize = 1; pp.query("chunkSize",chunkSize);
+  if (chunkSize < 1) {
+    BoxLib::Abort("chunkSize must be at least 1");
+  }
 
 #ifndef TESTDATA
   UqPlotfile pf;
-  pf.Read(sampleFile);
+  pf.Read_serial(sampleFile);
   int iter = pf.ITER();
   int iters = pf.NITERS();
   int nwalkers = pf.NWALKERS();
@@ -59,113 +269,119 @@ main (int   argc,
   if (ndim != driver.NumParams()) {
     BoxLib::Abort("Number of parameters inconsistent between samples and input file");
   }
-  std::vector<Real> samples;
-  if (ioproc) {
-#ifndef TESTDATA
-    samples = pf.LoadEnsemble(iter, iters);
-#else
-    samples.resize(nwalkers*iters*ndim);
-    for (int k=0; k<nwalkers; ++k) {
-      for (int t=iter; t<iter+iters; ++t) {
-	for (int j=0; j<ndim; ++j) {
-	  long index = k + nwalkers*(t-iter) + nwalkers*iters*j;
-	  samples[index] = j;
-	}
-      }
-    }
-#endif
-  }
-  else {
-    samples.resize(iters*nwalkers*ndim);
-  }
-  ParallelDescriptor::ReduceRealSum(&(samples[0]),samples.size());
 
   std::cout << std::setprecision(8);
   std::cout << std::scientific;
-  std::vector<Real> mySamples(ndim);
-  std::vector<Real> F(nwalkers*iters,0);
 
+  int nsamples = nwalkers*iters;
   int nData = driver.NumData();
-  std::vector<Real> D;
-  if (writeExptData) {
-    D.resize(nwalkers*iters*nData,0);
-  }
-  int nDigits = (int)(std::log10(nwalkers*iters)) + 1;
+  int nD = (writeExptData ? nData : 0);
+  int nDigits = (int)(std::log10(nsamples)) + 1;
 
-  std::vector<Real> svals(nData);
-  std::vector<Real> dvals(nData);
-  Real Fa, Fb;
-
-  for (int k=0; k<nwalkers; ++k) {
-    for (int t=iter; t<iter+iters; ++t) {
+#ifdef BL_USE_MPI
+  const int work_tag = 1;
+  const int result_tag = 2;
+#endif
 
-      int sampleID = nwalkers*(t-iter) + k;
+  if (ioproc) {
+    // Sample sampleID = nwalkers*(t-iter) + k has component j at
+    // sampleID + nsamples*j, as F and D
+#ifndef TESTDATA
+    std::vector<Real> samples = pf.LoadEnsemble(iter, iters);
+#else
+    std::vector<Real> samples((size_t)nsamples*ndim);
+    for (int i=0; i<nsamples; ++i) {
+      for (int j=0; j<ndim; ++j) {
+        samples[i + (size_t)nsamples*j] = j;
+      }
+    }
+#endif
+    std::vector<Real> F(nsamples,0);
+    std::vector<Real> D((size_t)nsamples*nD,0);
+    std::vector<bool> done(nsamples,false);
 
-      if (sampleID % nprocs == myproc) {
+    int shape[6] = {ProgressVersion, iter, iters, nwalkers, ndim, nD};
+    InitProgress(progressFile,ProgressHeader(shape,samples,sampleFile),nD,F,D,done);
+    std::ofstream progress(progressFile.c_str(), std::ios::binary | std::ios::app);
 
-	for (int j=0; j<ndim; ++j) {
-	  long index = k + nwalkers*(t-iter) + nwalkers*iters*j;
-	  mySamples[j] = samples[index];
-	}
+    std::deque<int> todo;
+    for (int i=0; i<nsamples; ++i) {
+      if (!done[i]) {
+        todo.push_back(i);
+      }
+    }
 
-	std::string my_prefix = BoxLib::Concatenate(diagnostic_prefix,sampleID,nDigits) + "/";
-	expt_manager.SetDiagnosticPrefix(my_prefix);
+    std::vector<double> chunk, recs;
+    if (nprocs == 1) {
+      while (!todo.empty()) {
+        int n = NextChunk(todo,chunkSize,samples,nsamples,ndim,chunk);
+        EvaluateChunk(driver,chunk,n,ndim,nD,diagnostic_prefix,nDigits,verbose,recs);
+        StoreResults(&(recs[0]),n,nD,F,D,done,progress);
+      }
+    }
+#ifdef BL_USE_MPI
+    else {
+      // Each worker asks for work with the results of its last chunk
+      // (none at first), and is told to stop with an empty chunk
+      MPI_Comm comm = ParallelDescriptor::Communicator();
+      int active = nprocs - 1;
+      while (active > 0) {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, result_tag, comm, &status);
+        int len;
+        MPI_Get_count(&status, MPI_DOUBLE, &len);
+        recs.resize(std::max(len,1));
+        MPI_Recv(&(recs[0]), len, MPI_DOUBLE, status.MPI_SOURCE, result_tag, comm, MPI_STATUS_IGNORE);
+        if (len > 0) {
+          StoreResults(&(recs[0]),len/(2+nD),nD,F,D,done,progress);
+        }
 
-#ifndef TESTDATA
-	F[sampleID] = driver.VerboseLogLikelihood(mySamples,dvals,svals,Fa,Fb);
-#else
-	F[sampleID] = sampleID;
+        int n = NextChunk(todo,chunkSize,samples,nsamples,ndim,chunk);
+        if (n == 0) {
+          active--;
+        }
+        MPI_Send(n > 0 ? &(chunk[0]) : 0, n*(1+ndim), MPI_DOUBLE, status.MPI_SOURCE, work_tag, comm);
+      }
+    }
 #endif
+    progress.close();
 
-	if (writeExptData) {
-	  for (int j=0; j<nData; ++j) {
-	    long index = k + nwalkers*(t-iter) + nwalkers*iters*j;
-#ifndef TESTDATA
-	    D[index] = dvals[j];
-#else
-	    D[index] = j;
-#endif
-	  }
-	}
-
-	if (verbose) {
-	  std::cout << sampleID << " [";
-	  for (int j=0; j<ndim; ++j) {
-	    long index = k + nwalkers*(t-iter) + nwalkers*iters*j;
-	    std::cout << "  " << samples[index];
-	    if (j<ndim-1) std::cout << " ";
-	  }
-	  std::cout << "] F = " << F[sampleID];
-	  if (writeExptData) {
-	    std::cout << " D = [";
-	    for (int j=0; j<nData; ++j) {
-	      long index = k + nwalkers*(t-iter) + nwalkers*iters*j;
-	      std::cout << "  " << D[index];
-	      if (j<nData-1) std::cout << " ";
-	    }
-	    std::cout << " ]";
-	  }
-	  std::cout << std::endl;
-	}
+    for (int i=0; i<nsamples; ++i) {
+      if (!done[i]) {
+        BoxLib::Abort("EvalExpt: not all samples were evaluated");
       }
     }
-  }
 
-  ParallelDescriptor::ReduceRealSum(&(F[0]),F.size());
-  if (writeExptData) {
-    ParallelDescriptor::ReduceRealSum(&(D[0]),D.size());
-  }
-  if (ioproc) {
-    std::string Ffile = "Ffile"; pp.query("Ffile",Ffile);
     UqPlotfile pfi(F,1,1,0,F.size(),"");
     pfi.Write(Ffile);
 
     if (writeExptData) {
-      std::string Dfile = "Dfile"; pp.query("Dfile",Dfile);
       UqPlotfile pfiD(D,nData,nwalkers,iter,iters,"");
       pfiD.Write(Dfile);
     }
+    std::remove(progressFile.c_str());
+  }
+#ifdef BL_USE_MPI
+  else {
+    MPI_Comm comm = ParallelDescriptor::Communicator();
+    int ioproc_number = ParallelDescriptor::IOProcessorNumber();
+    std::vector<double> chunk, recs;
+    int n = 0;
+    while (true) {
+      MPI_Send(n > 0 ? &(recs[0]) : 0, (int)recs.size(), MPI_DOUBLE, ioproc_number, result_tag, comm);
+      MPI_Status status;
+      MPI_Probe(ioproc_number, work_tag, comm, &status);
+      int len;
+      MPI_Get_count(&status, MPI_DOUBLE, &len);
+      chunk.resize(std::max(len,1));
+      MPI_Recv(&(chunk[0]), len, MPI_DOUBLE, ioproc_number, work_tag, comm, MPI_STATUS_IGNORE);
+      n = len / (1+ndim);
+      if (n == 0) {
+        break;
+      }
+      EvaluateChunk(driver,chunk,n,ndim,nD,diagnostic_prefix,nDigits,verbose,recs);
+    }
   }
+#endif
   ParallelDescriptor::Barrier();
 }
-
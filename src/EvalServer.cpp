@@ -0,0 +1,391 @@
+#include <EvalServer.H>
+#include <Utility.H>
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static bool
+ReadAll(int fd, void* buf, size_t len)
+{
+  char* p = static_cast<char*>(buf);
+  while (len > 0) {
+    ssize_t n = recv(fd,p,len,0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool
+WriteAll(int fd, const void* buf, size_t len)
+{
+  const char* p = static_cast<const char*>(buf);
+  while (len > 0) {
+    ssize_t n = send(fd,p,len,MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void
+SocketAddress(const std::string& socket_name, sockaddr_un& addr)
+{
+  if (socket_name.size() >= sizeof(addr.sun_path)) {
+    BoxLib::Abort("EvalServer: socket name too long: " + socket_name);
+  }
+  std::memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strcpy(addr.sun_path,socket_name.c_str());
+}
+
+struct EvalServerClient
+{
+  EvalServer* server;
+  int fd;
+};
+
+EvalServer::EvalServer(const std::string& socket_name, int nparams, int ndata,
+                       LogLikelihoodBatch loglikelihood, MeasurementsBatch measurements)
+  : m_socket_name(socket_name), m_nparams(nparams), m_ndata(ndata),
+    m_loglikelihood(loglikelihood), m_measurements(measurements), m_shutdown(false)
+{
+  sockaddr_un addr;
+  SocketAddress(m_socket_name,addr);
+  m_listen_fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if (m_listen_fd < 0) {
+    BoxLib::Abort("EvalServer: unable to create socket");
+  }
+  unlink(m_socket_name.c_str());
+  if (bind(m_listen_fd,(sockaddr*)&addr,sizeof(addr)) != 0
+      || listen(m_listen_fd,16) != 0) {
+    BoxLib::Abort("EvalServer: unable to listen on " + m_socket_name);
+  }
+
+  pthread_mutex_init(&m_mutex,0);
+  pthread_cond_init(&m_cond,0);
+  pthread_create(&m_accept_thread,0,Accept,this);
+}
+
+// Stop accepting, drop the connected clients, and wait for their
+// threads to finish
+EvalServer::~EvalServer()
+{
+  shutdown(m_listen_fd,SHUT_RDWR);
+  close(m_listen_fd);
+  pthread_join(m_accept_thread,0);
+
+  pthread_mutex_lock(&m_mutex);
+  m_shutdown = true;
+  FailQueued();
+  for (std::set<int>::const_iterator it=m_clients.begin(); it!=m_clients.end(); ++it) {
+    shutdown(*it,SHUT_RDWR);
+  }
+  while (!m_clients.empty()) {
+    pthread_cond_wait(&m_cond,&m_mutex);
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  unlink(m_socket_name.c_str());
+  pthread_mutex_destroy(&m_mutex);
+  pthread_cond_destroy(&m_cond);
+}
+
+void*
+EvalServer::Accept(void* server)
+{
+  EvalServer* s = static_cast<EvalServer*>(server);
+  for (;;) {
+    int fd = accept(s->m_listen_fd,0,0);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    pthread_mutex_lock(&s->m_mutex);
+    bool shutting_down = s->m_shutdown;
+    if (!shutting_down) {
+      s->m_clients.insert(fd);
+    }
+    pthread_mutex_unlock(&s->m_mutex);
+    if (shutting_down) {
+      close(fd);
+      continue;
+    }
+
+    EvalServerClient* c = new EvalServerClient;
+    c->server = s;
+    c->fd = fd;
+    pthread_t thread;
+    pthread_create(&thread,0,Serve,c);
+    pthread_detach(thread);
+  }
+  return 0;
+}
+
+void*
+EvalServer::Serve(void* client)
+{
+  EvalServerClient* c = static_cast<EvalServerClient*>(client);
+  c->server->ServeClient(c->fd);
+  delete c;
+  return 0;
+}
+
+void
+EvalServer::ServeClient(int fd)
+{
+  int header[3];
+  while (ReadAll(fd,header,sizeof(header))) {
+    int op = header[0], n = header[1], np = header[2];
+    if (op == EVAL_INFO || op == EVAL_SHUTDOWN) {
+      n = 0;
+      np = m_nparams;
+    }
+    if (n < 0 || n > MaxSamples || np != m_nparams
+        || op < EVAL_INFO || op > EVAL_SHUTDOWN) {
+      int status = -1;
+      WriteAll(fd,&status,sizeof(int));
+      break;
+    }
+
+    Request r;
+    r.op = op;
+    r.n = n;
+    r.status = 0;
+    r.done = false;
+    r.x.resize((size_t)n*np);
+    if (n > 0 && !ReadAll(fd,&(r.x[0]),r.x.size()*sizeof(double))) {
+      break;
+    }
+
+    bool ok;
+    if (op == EVAL_INFO) {
+      int info[3] = {0, m_nparams, m_ndata};
+      ok = WriteAll(fd,info,sizeof(info));
+    }
+    else if (op == EVAL_SHUTDOWN) {
+      pthread_mutex_lock(&m_mutex);
+      m_shutdown = true;
+      pthread_cond_broadcast(&m_cond);
+      pthread_mutex_unlock(&m_mutex);
+      ok = WriteAll(fd,&r.status,sizeof(int));
+    }
+    else {
+      // Run stops taking requests once shut down
+      pthread_mutex_lock(&m_mutex);
+      if (m_shutdown) {
+        r.status = -1;
+        r.done = true;
+      }
+      else {
+        m_queue.push_back(&r);
+        pthread_cond_broadcast(&m_cond);
+      }
+      while (!r.done) {
+        pthread_cond_wait(&m_cond,&m_mutex);
+      }
+      pthread_mutex_unlock(&m_mutex);
+
+      ok = WriteAll(fd,&r.status,sizeof(int));
+      if (r.status == 0) {
+        if (op == EVAL_MEASUREMENTS) {
+          ok = ok && (n == 0 || WriteAll(fd,&(r.ok[0]),n*sizeof(int)));
+        }
+        ok = ok && (r.result.empty() || WriteAll(fd,&(r.result[0]),r.result.size()*sizeof(double)));
+      }
+    }
+    if (!ok) {
+      break;
+    }
+  }
+
+  close(fd);
+  pthread_mutex_lock(&m_mutex);
+  m_clients.erase(fd);
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// The samples of all the requests, one after the other, in one batch
+void
+EvalServer::Evaluate(std::vector<Request*>& requests, int op)
+{
+  int ntot = 0;
+  for (int i=0; i<requests.size(); ++i) {
+    ntot += requests[i]->n;
+  }
+  if (ntot == 0) {
+    return;
+  }
+  int nout = (op == EVAL_LOGLIKELIHOOD ? 1 : m_ndata);
+  std::vector<double> x((size_t)ntot*m_nparams), result((size_t)ntot*nout);
+  std::vector<int> ok(ntot,1);
+  size_t offset = 0;
+  for (int i=0; i<requests.size(); ++i) {
+    std::copy(requests[i]->x.begin(),requests[i]->x.end(),x.begin() + offset*m_nparams);
+    offset += requests[i]->n;
+  }
+
+  if (op == EVAL_LOGLIKELIHOOD) {
+    m_loglikelihood(&(x[0]),ntot,&(result[0]));
+  }
+  else {
+    m_measurements(&(x[0]),ntot,&(result[0]),&(ok[0]));
+  }
+
+  offset = 0;
+  for (int i=0; i<requests.size(); ++i) {
+    int n = requests[i]->n;
+    requests[i]->result.assign(result.begin() + offset*nout, result.begin() + (offset + n)*nout);
+    requests[i]->ok.assign(ok.begin() + offset, ok.begin() + offset + n);
+    offset += n;
+  }
+}
+
+void
+EvalServer::FailQueued()
+{
+  for (int i=0; i<m_queue.size(); ++i) {
+    m_queue[i]->status = -1;
+    m_queue[i]->done = true;
+  }
+  m_queue.clear();
+  pthread_cond_broadcast(&m_cond);
+}
+
+void
+EvalServer::Run()
+{
+  for (;;) {
+    pthread_mutex_lock(&m_mutex);
+    while (m_queue.empty() && !m_shutdown) {
+      pthread_cond_wait(&m_cond,&m_mutex);
+    }
+    if (m_queue.empty()) {
+      FailQueued();
+      pthread_mutex_unlock(&m_mutex);
+      return;
+    }
+    std::deque<Request*> requests;
+    requests.swap(m_queue);
+    pthread_mutex_unlock(&m_mutex);
+
+    std::vector<Request*> ll, meas;
+    for (int i=0; i<requests.size(); ++i) {
+      if (requests[i]->op == EVAL_LOGLIKELIHOOD) {
+        ll.push_back(requests[i]);
+      }
+      else {
+        meas.push_back(requests[i]);
+      }
+    }
+    Evaluate(ll,EVAL_LOGLIKELIHOOD);
+    Evaluate(meas,EVAL_MEASUREMENTS);
+
+    pthread_mutex_lock(&m_mutex);
+    for (int i=0; i<requests.size(); ++i) {
+      requests[i]->done = true;
+    }
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+}
+
+EvalClient::EvalClient(const std::string& socket_name)
+{
+  sockaddr_un addr;
+  SocketAddress(socket_name,addr);
+  m_fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if (m_fd < 0 || connect(m_fd,(sockaddr*)&addr,sizeof(addr)) != 0) {
+    BoxLib::Abort("EvalClient: unable to connect to " + socket_name);
+  }
+
+  // The number of parameters is not known yet, so ask with none
+  m_nparams = 0;
+  int header[3] = {EVAL_INFO, 0, -1};
+  int reply[3];
+  if (!WriteAll(m_fd,header,sizeof(header))
+      || !ReadAll(m_fd,reply,sizeof(int))) {
+    BoxLib::Abort("EvalClient: no reply from " + socket_name);
+  }
+  if (reply[0] != 0) {
+    BoxLib::Abort("EvalClient: request refused by " + socket_name);
+  }
+  ReadAll(m_fd,reply+1,2*sizeof(int));
+  m_nparams = reply[1];
+  m_ndata = reply[2];
+}
+
+EvalClient::~EvalClient()
+{
+  close(m_fd);
+}
+
+void
+EvalClient::Send(int op, const double* x, int n)
+{
+  int header[3] = {op, n, m_nparams};
+  if (!WriteAll(m_fd,header,sizeof(header))
+      || (n > 0 && !WriteAll(m_fd,x,(size_t)n*m_nparams*sizeof(double)))) {
+    BoxLib::Abort("EvalClient: connection lost");
+  }
+}
+
+void
+EvalClient::ReceiveStatus()
+{
+  int status;
+  if (!ReadAll(m_fd,&status,sizeof(int))) {
+    BoxLib::Abort("EvalClient: connection lost");
+  }
+  if (status != 0) {
+    BoxLib::Abort("EvalClient: request refused");
+  }
+}
+
+void
+EvalClient::LogLikelihoodBatch(const double* x, int n, double* logL)
+{
+  Send(EVAL_LOGLIKELIHOOD,x,n);
+  ReceiveStatus();
+  if (n > 0 && !ReadAll(m_fd,logL,n*sizeof(double))) {
+    BoxLib::Abort("EvalClient: connection lost");
+  }
+}
+
+void
+EvalClient::MeasurementsBatch(const double* x, int n, double* data, int* ok)
+{
+  Send(EVAL_MEASUREMENTS,x,n);
+  ReceiveStatus();
+  if (n > 0 && (!ReadAll(m_fd,ok,n*sizeof(int))
+                || !ReadAll(m_fd,data,(size_t)n*m_ndata*sizeof(double)))) {
+    BoxLib::Abort("EvalClient: connection lost");
+  }
+}
+
+void
+EvalClient::Shutdown()
+{
+  Send(EVAL_SHUTDOWN,0,0);
+  ReceiveStatus();
+}
@@ -1,15 +1,83 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
 #include <ExperimentManager.H>
 #include <Rand.H>
 #include <ParmParse.H>
 #include <ParallelDescriptor.H>
+#include <ParallelGroups.H>
+#include <Tracer.H>
 #include <Utility.H>
 #include <omp.h>
 
 static bool log_failed_cases_DEF = true;
 static std::string log_folder_name_DEF = "FAILED";
 static int override_expt_verbosity_DEF = -1; // -1=inactive, 0=not verbose, 1+=verbose
+static int max_refinements_DEF = 100; // Reruns to converge single-value diagnostics
+static std::string startup_cache_dir_DEF = ""; // No startup cache
+static std::string profile_file_DEF = ""; // Profile printed only
+
+// 64-bit FNV-1a hash, in hex
+static std::string
+HashString(const std::string& s)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i=0; i<s.size(); ++i) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  char buf[17];
+  std::snprintf(buf,sizeof(buf),"%016llx",h);
+  return buf;
+}
+
+static std::string
+HashFile(const std::string& name)
+{
+  std::ifstream ifs(name.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs.good()) {
+    return "missing";
+  }
+  std::ostringstream os;
+  os << ifs.rdbuf();
+  return HashString(os.str());
+}
+
+// Species, reactions and current rate parameters of the mechanism
+static std::string
+MechanismKey(const ChemDriver& cd)
+{
+  std::ostringstream os;
+  const Array<std::string>& species = cd.speciesNames();
+  for (int i=0; i<species.size(); ++i) {
+    os << species[i] << '\n';
+  }
+  for (int i=0; i<cd.numReactions(); ++i) {
+    os << cd.reactionStringBuild(i) << '\n' << cd.printReactionParameters(i) << '\n';
+  }
+  return HashString(os.str());
+}
+
+// Inputs under prefix, as listed by the ParmParse table
+static std::string
+InputsWithPrefix(const std::string& table, const std::string& prefix)
+{
+  std::string name = prefix + ".";
+  std::string result;
+  std::istringstream is(table);
+  std::string line;
+  while (std::getline(is,line)) {
+    size_t pos = line.find(name);
+    if (pos != std::string::npos && (pos == 0 || line[pos-1] == ' ' || line[pos-1] == '[')) {
+      result += line + '\n';
+    }
+  }
+  return result;
+}
 
 void
 ExperimentManager::SetDiagnosticPrefix(const std::string& prefix)
@@ -23,13 +91,18 @@ ExperimentManager::ExperimentManager(ParameterManager& pmgr, ChemDriver& cd, boo
   : use_synthetic_data(_use_synthetic_data), verbose(true),
     parameter_manager(pmgr), expts(PArrayManage), perturbed_data(0),
     log_failed_cases(log_failed_cases_DEF), log_folder_name(log_folder_name_DEF),
-    parallel_mode(PARALLELIZE_OVER_RANK)
+    parallel_mode(PARALLELIZE_OVER_RANK), fidelity(0)
 {
 
   ParmParse pp;
 
   pp.query("log_failed_cases",log_failed_cases);
   pp.query("log_folder_name",log_folder_name);
+  startup_cache_dir = startup_cache_dir_DEF;
+  pp.query("startup_cache_dir",startup_cache_dir);
+  profile_file = profile_file_DEF;
+  pp.query("profile_file",profile_file);
+  ResetProfile();
 
   int nExpts = pp.countval("experiments");
   Array<std::string> experiments;
@@ -38,6 +111,35 @@ ExperimentManager::ExperimentManager(ParameterManager& pmgr, ChemDriver& cd, boo
   override_expt_verbosity = override_expt_verbosity_DEF;
   pp.query("override_expt_verbosity",override_expt_verbosity);
 
+  // Entry l of each fidelity.* list is the setting at fidelity level
+  // l; missing entries are those of the full model.
+  //   time_points_factor:  scale of the output times searched for
+  //                        single-value 0D diagnostics
+  //   max_refinements:     reruns with refined output times to
+  //                        converge single-value 0D diagnostics
+  //   premix_max_iters:    cap on the PREMIX iterations
+  //   premix_regrid_points: PREMIX baseline restart grid size
+  ParmParse ppf("fidelity");
+  int nlev = std::max(1, std::max(std::max(ppf.countval("time_points_factor"),
+                                           ppf.countval("max_refinements")),
+                                  std::max(ppf.countval("premix_max_iters"),
+                                           ppf.countval("premix_regrid_points"))));
+  fidelity_levels.resize(nlev);
+  max_refinements.resize(nlev,max_refinements_DEF);
+  for (int l=0; l<ppf.countval("time_points_factor"); ++l) {
+    ppf.get("time_points_factor",fidelity_levels[l].time_points_factor,l);
+    BL_ASSERT(fidelity_levels[l].time_points_factor > 0);
+  }
+  for (int l=0; l<ppf.countval("max_refinements"); ++l) {
+    ppf.get("max_refinements",max_refinements[l],l);
+  }
+  for (int l=0; l<ppf.countval("premix_max_iters"); ++l) {
+    ppf.get("premix_max_iters",fidelity_levels[l].max_solver_iters,l);
+  }
+  for (int l=0; l<ppf.countval("premix_regrid_points"); ++l) {
+    ppf.get("premix_regrid_points",fidelity_levels[l].regrid_points,l);
+  }
+
   for (int i=0; i<nExpts; ++i) {
     std::string prefix = experiments[i];
     ParmParse ppe(prefix.c_str());
@@ -94,6 +196,18 @@ ExperimentManager::ExperimentManager(ParameterManager& pmgr, ChemDriver& cd, boo
   }
 }
 
+void
+ExperimentManager::SetFidelity(int level)
+{
+  if (level < 0 || level >= fidelity_levels.size()) {
+    BoxLib::Abort("ExperimentManager::SetFidelity: invalid fidelity level");
+  }
+  fidelity = level;
+  for (int i=0; i<expts.size(); ++i) {
+    expts[i].SetFidelity(fidelity_levels[fidelity]);
+  }
+}
+
 std::string
 ExperimentManager::GetParallelModeString() const
 {
@@ -132,6 +246,8 @@ ExperimentManager::Clear()
   data_offsets.clear();
   num_expt_data = 0;
   expt_map.clear();
+  profile.clear();
+  profile_failures.clear();
 }
 
 void
@@ -149,6 +265,8 @@ ExperimentManager::AddExperiment(SimulatedExperiment* expt,
   num_expt_data = data_offsets[num_expts_old] + num_new_values;
   expt_map[expt_id] = num_expts_old;
   expt_name.push_back(expt_id);
+  profile.push_back(std::vector<Real>(NUM_PROFILE_COUNTERS,0));
+  profile_failures.push_back(std::vector<Real>(SimulatedExperiment::ErrorMap().size(),0));
 }
 
 void
@@ -159,51 +277,84 @@ ExperimentManager::InitializeExperiments()
   }
 }
 
+// The startup products (baselines, and synthetic data at the true
+// parameters) of each experiment are read from the startup cache when
+// present.  The others are computed, split over the ranks and, on
+// each rank, over the threads, and added to the cache.
 void
 ExperimentManager::InitializeTrueData(const std::vector<Real>& true_parameters)
 {
   if (use_synthetic_data) {
-    GenerateTestMeasurements(true_parameters,true_data);
+    for (int i=0; i<true_parameters.size(); ++i) {
+      parameter_manager.SetParameter(i,true_parameters[i]);
+    }
+    true_data.resize(NumExptData());
+  }
+
+  int N = expts.size();
+  int nprocs = ParallelDescriptor::NProcs();
+  std::vector<std::string> keys(N);
+  std::vector<int> cached(N,0);
+  if (startup_cache_dir != "") {
+    std::string mechanism_key = MechanismKey(parameter_manager.cd);
+    for (int i=0; i<N; ++i) {
+      keys[i] = StartupCacheKey(i,mechanism_key);
+    }
+    if (ParallelDescriptor::IOProcessor()) {
+      for (int i=0; i<N; ++i) {
+        cached[i] = ReadStartupCache(i,keys[i]);
+      }
+    }
+    if (N > 0) {
+      ParallelDescriptor::Bcast(&(cached[0]),N,ParallelDescriptor::IOProcessorNumber());
+    }
+  }
+
+  // Experiments not in the cache, dealt out to the ranks in turn
+  std::vector<int> owner(N,ParallelDescriptor::IOProcessorNumber());
+  std::vector<int> mine;
+  int nmiss = 0;
+  for (int i=0; i<N; ++i) {
+    if (!cached[i]) {
+      owner[i] = nmiss++ % nprocs;
+      if (owner[i] == ParallelDescriptor::MyProc()) {
+        mine.push_back(i);
+      }
+    }
+  }
+  if (verbose && ParallelDescriptor::IOProcessor()) {
+    std::cout << "Startup products: " << N - nmiss << " of " << N
+              << " experiments from the cache" << std::endl;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+  for (int m=0; m<mine.size(); ++m) {
+    ComputeStartupProducts(mine[m]);
+  }
+  if (startup_cache_dir != "") {
+    for (int m=0; m<mine.size(); ++m) {
+      WriteStartupCache(mine[m],keys[mine[m]]);
+    }
   }
 
   true_std.resize(NumExptData());
-  for (int i=0; i<expts.size(); ++i) {
-          // std::cerr << 
-          //     "Saving baseline solution only on IO proc " << std::endl <<
-          //     " ******* probably not what we want for every case" << std::endl;
-	  if (ParallelDescriptor::IOProcessor()) {
-		  std::string prefix = expt_name[i];
-		  expts[i].SaveBaselineSolution(prefix);
-	  }
+  for (int i=0; i<N; ++i) {
+    expts[i].BcastBaselineSolution(owner[i]);
 
     BL_ASSERT(expts.defined(i));
     const SimulatedExperiment& expt = expts[i];
     int n = expt.NumMeasuredValues();
     BL_ASSERT(n <= raw_data[i].size());
 
-
-    if (use_synthetic_data) {
-	std::string prefix = expt_name[i];
-    ParmParse ppe(prefix.c_str());
-	Real data_tstart = 0; ppe.query("data_tstart",data_tstart);
-  	Real data_tend = 0; ppe.query("data_tend",data_tend); BL_ASSERT(data_tend>0);
-  	int data_num_points = -1;
-  	ppe.query("data_num_points",data_num_points); BL_ASSERT(data_num_points>0);
-
-      std::pair<bool,int> retVal = expts[i].GetMeasurements(raw_data[i], data_num_points, data_tstart, data_tend);
-      if (!retVal.first) {
-        std::string msg = SimulatedExperiment::ErrorString(retVal.second);
-        std::cout << "Experiment " << i << "(" << expt_name[i]
-                  << ") failed while computing synthetic data.  Error message: \""
-                  << msg << "\"" << std::endl;
-        BoxLib::Abort();
-      }
-    }
-
     int offset = data_offsets[i];
     int nd = raw_data[i].size();
 
     if (use_synthetic_data) {
+      if (nd > 0) {
+        ParallelDescriptor::Bcast(&(raw_data[i][0]),nd,owner[i]);
+      }
       for (int j=0; j<nd; ++j) {
         true_data[offset + j] = raw_data[i][j];
       }
@@ -218,6 +369,130 @@ ExperimentManager::InitializeTrueData(const std::vector<Real>& true_parameters)
 
 }
 
+void
+ExperimentManager::ComputeStartupProducts(int i)
+{
+  std::string prefix = expt_name[i];
+  TraceScope trace(prefix,"startup");
+  expts[i].SaveBaselineSolution(prefix);
+
+  if (use_synthetic_data) {
+    ParmParse ppe(prefix.c_str());
+    Real data_tstart = 0; ppe.query("data_tstart",data_tstart);
+    Real data_tend = 0; ppe.query("data_tend",data_tend); BL_ASSERT(data_tend>0);
+    int data_num_points = -1;
+    ppe.query("data_num_points",data_num_points); BL_ASSERT(data_num_points>0);
+
+    std::pair<bool,int> retVal = expts[i].GetMeasurements(raw_data[i], data_num_points, data_tstart, data_tend);
+    if (!retVal.first) {
+      std::string msg = SimulatedExperiment::ErrorString(retVal.second);
+      std::cout << "Experiment " << i << "(" << expt_name[i]
+                << ") failed while computing synthetic data.  Error message: \""
+                << msg << "\"" << std::endl;
+      BoxLib::Abort();
+    }
+  }
+}
+
+// Everything the startup products of experiment i depend on: the
+// mechanism, the parameter values, the fidelity level, and the inputs
+// and input files of the experiment
+std::string
+ExperimentManager::StartupCacheKey(int i, const std::string& mechanism_key) const
+{
+  std::ostringstream os;
+  os << std::setprecision(17);
+  os << "mechanism " << mechanism_key << '\n';
+  for (int j=0; j<parameter_manager.NumParams(); ++j) {
+    os << "parameter " << parameter_manager.active_parameters[j].GetParamString()
+       << ' ' << parameter_manager.GetParameterCurrent(j) << '\n';
+  }
+  const SolverFidelity& f = fidelity_levels[fidelity];
+  os << "fidelity " << f.time_points_factor << ' ' << f.max_solver_iters
+     << ' ' << f.regrid_points << '\n';
+  os << "synthetic " << use_synthetic_data << '\n';
+
+  std::ostringstream table;
+  ParmParse::dumpTable(table);
+  std::vector<std::string> prefixes(1,expt_name[i]);
+  std::vector<std::string> files;
+  expts[i].GetInputs(prefixes,files);
+  for (int j=0; j<prefixes.size(); ++j) {
+    os << InputsWithPrefix(table.str(),prefixes[j]);
+  }
+  for (int j=0; j<files.size(); ++j) {
+    os << "file " << files[j] << ' ' << HashFile(files[j]) << '\n';
+  }
+  return os.str();
+}
+
+std::string
+ExperimentManager::StartupCacheEntry(const std::string& key) const
+{
+  return startup_cache_dir + "/" + HashString(key);
+}
+
+// An entry is complete once its Key file, written last, is in place,
+// and is used only if the full key matches
+bool
+ExperimentManager::ReadStartupCache(int i, const std::string& key)
+{
+  std::string entry = StartupCacheEntry(key);
+  std::ifstream kfs((entry + "/Key").c_str(), std::ios::in | std::ios::binary);
+  if (!kfs.good()) {
+    return false;
+  }
+  std::ostringstream stored;
+  stored << kfs.rdbuf();
+  if (stored.str() != key) {
+    return false;
+  }
+
+  if (use_synthetic_data) {
+    std::ifstream dfs((entry + "/Data").c_str());
+    int nd = -1;
+    dfs >> nd;
+    if (!dfs.good() || nd != raw_data[i].size()) {
+      return false;
+    }
+    for (int j=0; j<nd; ++j) {
+      dfs >> raw_data[i][j];
+    }
+    if (dfs.fail()) {
+      return false;
+    }
+  }
+  return expts[i].ReadBaselineSolution(entry + "/Baseline");
+}
+
+void
+ExperimentManager::WriteStartupCache(int i, const std::string& key) const
+{
+  std::string entry = StartupCacheEntry(key);
+  if (!BoxLib::UtilCreateDirectory(entry, 0755)) {
+    BoxLib::CreateDirectoryFailed(entry);
+  }
+  if (!expts[i].WriteBaselineSolution(entry + "/Baseline")) {
+    return;
+  }
+
+  if (use_synthetic_data) {
+    std::ofstream dfs((entry + "/Data").c_str());
+    dfs << std::setprecision(17) << raw_data[i].size() << '\n';
+    for (int j=0; j<raw_data[i].size(); ++j) {
+      dfs << raw_data[i][j] << '\n';
+    }
+    dfs.close();
+  }
+
+  std::string kname = entry + "/Key";
+  std::string tmp = kname + "." + BoxLib::Concatenate("",ParallelDescriptor::MyProc(),1);
+  std::ofstream kfs(tmp.c_str(), std::ios::out | std::ios::binary);
+  kfs << key;
+  kfs.close();
+  std::rename(tmp.c_str(),kname.c_str());
+}
+
 void
 ExperimentManager::GenerateExptData()
 {
@@ -249,6 +524,7 @@ ExperimentManager::EvaluateMeasurements_threaded(const std::vector<Real>& test_p
   bool pvtok = ok;
   int N = expts.size();
   Array<int> msgID(N,-1);
+  int max_refine = max_refinements[fidelity];
 
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic,1) firstprivate(pvtok)
@@ -271,7 +547,10 @@ ExperimentManager::EvaluateMeasurements_threaded(const std::vector<Real>& test_p
       //          << " on thread id " << omp_get_thread_num() 
       //          << " of " << nthreads << std::endl;
 
+      TraceScope trace(expt_name[i],"experiment");
       std::pair<bool,int> retVal;
+      Real wall_time = ParallelDescriptor::second();
+      expts[i].ClearCounters();
       retVal = expts[i].GetMeasurements(raw_data[i], data_num_points, data_tstart, data_tend);	
 		//std::cout << "Experiment " << i << " (" << expt_name[i] << ") failed.  Err msg: \""
 		  //<< SimulatedExperiment::ErrorString(retVal.second) << "\""<< std::endl;
@@ -287,10 +566,10 @@ ExperimentManager::EvaluateMeasurements_threaded(const std::vector<Real>& test_p
 		}
 	  }
 
-	  int count = 0, countdiff = 0; 
+	  int count = 0, countdiff = 0, reruns = 0; 
       if (retVal.first) countdiff++;
       double diff = 10;	
-      while ((!retVal.first && !flag_leen && count++ < 100) || (diff > 1.0 && !flag_leen && count++ < 100) || (countdiff < 2 && !flag_leen && count++ < 100)) {				
+      while ((!retVal.first && !flag_leen && count++ < max_refine) || (diff > 1.0 && !flag_leen && count++ < max_refine) || (countdiff < 2 && !flag_leen && count++ < max_refine)) {				
        double raw_data_old = raw_data[i][0];
 	   if (SimulatedExperiment::ErrorString(retVal.second) == "NEEDED_MEAN_BUT_NOT_FINISHED"){
           data_tend = data_tend*2;
@@ -300,6 +579,7 @@ ExperimentManager::EvaluateMeasurements_threaded(const std::vector<Real>& test_p
 	   data_num_points = data_num_points*10;
        }
        retVal = expts[i].GetMeasurements(raw_data[i], data_num_points, data_tstart, data_tend); 
+       reruns++;
        diff = abs(raw_data[i][0] - raw_data_old)*100/raw_data_old; 
 	   if (!retVal.first) { diff = 10; }
        else { countdiff ++; }
@@ -322,6 +602,7 @@ std::cout << "diff = " << diff << " " << data_num_points << " " << data_tend <<
 
       }
 	//}
+      ProfileEvaluation(i,retVal,reruns,ParallelDescriptor::second() - wall_time);
 
 //else {
 // #ifdef _OPENMP
@@ -366,6 +647,15 @@ std::cout << "diff = " << diff << " " << data_num_points << " " << data_tend <<
   return ok;
 }
 
+#ifdef BL_USE_MPI
+// Buffer of v for MPI (&v[0] is undefined for an empty vector)
+static Real*
+DataPtr(std::vector<Real>& v)
+{
+  return (v.empty() ? 0 : &(v[0]));
+}
+#endif
+
 bool
 ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& test_params,
 						    std::vector<Real>&       test_measurements)
@@ -376,23 +666,28 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
   int intok = -1;
   Array<int> msgID(expts.size(),-1);
 
+  // The experiments are shared by the ranks of this group, in its
+  // communicator; ranks below are ranks in the group
+  MPI_Comm wcomm = ParallelGroups::GroupCommunicator();
+  MPI_Datatype real_type = ParallelDescriptor::Mpi_typemap<Real>::type();
+  int master = 0;
+
   // All ranks use the parameters installed in the root
-  ParallelDescriptor::Bcast(const_cast<Real*>(&test_params[0]), test_params.size(), 0);
+  MPI_Bcast(const_cast<Real*>(&test_params[0]), test_params.size(), real_type, master, wcomm);
 
   // Task parallel option over experiments - serial option follows below
-  if (ParallelDescriptor::IOProcessor() && verbose){
-    std::cout << "Have " << ParallelDescriptor::NProcs() << " procs " << std::endl;
+  if (ParallelGroups::GroupLeader() && verbose){
+    std::cout << "Have " << ParallelGroups::GroupSize() << " procs " << std::endl;
   }
   bool am_worker = false;
-  int master = 0;
-  if (ParallelDescriptor::MyProc() == master) {
+  if (ParallelGroups::MyProcInGroup() == master) {
     am_worker = false;
   }
   else {
     am_worker = true;
   }
   int first_worker = 1;
-  int last_worker = ParallelDescriptor::NProcs() - 1;
+  int last_worker = ParallelGroups::GroupSize() - 1;
 
   typedef enum { READY, HAVE_RESULTS } workerstatus_t;
   typedef enum { WORK, STOP } workercommand_t;
@@ -400,8 +695,6 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
   const int data_tag = 1;
   const int extra_tag = 2;
 
-  MPI_Comm wcomm = ParallelDescriptor::Communicator();
-
   if (am_worker) {
     bool more_work = true;
 
@@ -427,14 +720,22 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 
 	// After command to work needs to come instructions on what to do
 	int which_experiment = -1;
-	ParallelDescriptor::Recv(&which_experiment,1,master,data_tag);
+	MPI_Recv(&which_experiment, 1, MPI_INT, master, data_tag, wcomm, MPI_STATUS_IGNORE);
+	int level = 0;
+	MPI_Recv(&level, 1, MPI_INT, master, data_tag, wcomm, MPI_STATUS_IGNORE);
+	expts[which_experiment].SetFidelity(fidelity_levels[level]);
 
 	if (verbose) {
 	  std::cout << " Worker " << ParallelDescriptor::MyProc() << 
 	    " starting on experiment number " << which_experiment <<
 	    " (" << ExperimentNames() [which_experiment] << ")" << std::endl;
 	}
-	expts[which_experiment].CopyData(master,ParallelDescriptor::MyProc(),extra_tag);
+	{
+	  TraceScope trace("receive " + expt_name[which_experiment],"mpi");
+	  Real comm_time = ParallelDescriptor::second();
+	  expts[which_experiment].CopyData(ParallelGroups::GroupProc(master),ParallelDescriptor::MyProc(),extra_tag);
+	  profile_comm_time += ParallelDescriptor::second() - comm_time;
+	}
 
 	// Do the work
 
@@ -445,7 +746,14 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
   	int data_num_points = -1;
   	ppe.query("data_num_points",data_num_points); BL_ASSERT(data_num_points>0);	
 
-	std::pair<bool,int> retVal = expts[which_experiment].GetMeasurements(raw_data[which_experiment], data_num_points, data_tstart, data_tend);
+	Real wall_time = ParallelDescriptor::second();
+	expts[which_experiment].ClearCounters();
+	std::pair<bool,int> retVal;
+	{
+	  TraceScope trace(expt_name[which_experiment],"experiment");
+	  retVal = expts[which_experiment].GetMeasurements(raw_data[which_experiment], data_num_points, data_tstart, data_tend);
+	}
+	ProfileEvaluation(which_experiment,retVal,0,ParallelDescriptor::second() - wall_time);
 	if (retVal.first) {
 	  intok = 1;
 	}
@@ -457,14 +765,19 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 	    " finished experiment number " << which_experiment << std::endl;
 	}
 	// Send back the result
-	mystatus = HAVE_RESULTS;
-	MPI_Send(&mystatus, 1, MPI_INTEGER, master, control_tag, wcomm);
-        
-	ParallelDescriptor::Send(&which_experiment,1,master,data_tag);
-	ParallelDescriptor::Send(&intok, 1, master, data_tag);
-	ParallelDescriptor::Send(&retVal.second, 1, master, data_tag);
-	ParallelDescriptor::Send(raw_data[which_experiment], master, data_tag);
-	expts[which_experiment].CopyData(ParallelDescriptor::MyProc(),master,extra_tag);
+	{
+	  TraceScope trace("send " + expt_name[which_experiment],"mpi");
+	  Real comm_time = ParallelDescriptor::second();
+	  mystatus = HAVE_RESULTS;
+	  MPI_Send(&mystatus, 1, MPI_INTEGER, master, control_tag, wcomm);
+
+	  MPI_Send(&which_experiment, 1, MPI_INT, master, data_tag, wcomm);
+	  MPI_Send(&intok, 1, MPI_INT, master, data_tag, wcomm);
+	  MPI_Send(&retVal.second, 1, MPI_INT, master, data_tag, wcomm);
+	  MPI_Send(DataPtr(raw_data[which_experiment]), raw_data[which_experiment].size(), real_type, master, data_tag, wcomm);
+	  expts[which_experiment].CopyData(ParallelDescriptor::MyProc(),ParallelGroups::GroupProc(master),extra_tag);
+	  profile_comm_time += ParallelDescriptor::second() - comm_time;
+	}
 	if (verbose) {
 	  std::cout << " Worker " << ParallelDescriptor::MyProc() << 
 	    " finished sending data back " << which_experiment << std::endl;
@@ -506,6 +819,7 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 	std::cout << ")" << std::endl;
       }
       current_worker = status.MPI_SOURCE;
+      Real comm_time = ParallelDescriptor::second();
       MPI_Recv(&worker_status, 1, MPI_INTEGER, current_worker, control_tag, 
 	       wcomm, MPI_STATUS_IGNORE);
 
@@ -514,18 +828,21 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 	MPI_Send(&worker_command, 1, MPI_INTEGER, current_worker, control_tag, wcomm);
 
 	// Delegate next experiment to this worker
-	ParallelDescriptor::Send(&Nexperiments_dispatched,1,current_worker,data_tag);
-	expts[Nexperiments_dispatched].CopyData(master,current_worker,extra_tag);
+	TraceScope trace("dispatch " + expt_name[Nexperiments_dispatched],"mpi");
+	MPI_Send(&Nexperiments_dispatched, 1, MPI_INT, current_worker, data_tag, wcomm);
+	MPI_Send(&fidelity, 1, MPI_INT, current_worker, data_tag, wcomm);
+	expts[Nexperiments_dispatched].CopyData(ParallelGroups::GroupProc(master),ParallelGroups::GroupProc(current_worker),extra_tag);
 
 	Nexperiments_dispatched++;
 
       }
       else if (worker_status == HAVE_RESULTS) {
 	// Fetch the results
+	TraceScope trace("receive","mpi");
 	int exp_num;
-	ParallelDescriptor::Recv(&exp_num,1,current_worker,data_tag);
-	ParallelDescriptor::Recv( &intok, 1, current_worker, data_tag );
-	ParallelDescriptor::Recv( &msgID[exp_num], 1, current_worker, data_tag );
+	MPI_Recv(&exp_num, 1, MPI_INT, current_worker, data_tag, wcomm, MPI_STATUS_IGNORE);
+	MPI_Recv(&intok, 1, MPI_INT, current_worker, data_tag, wcomm, MPI_STATUS_IGNORE);
+	MPI_Recv(&msgID[exp_num], 1, MPI_INT, current_worker, data_tag, wcomm, MPI_STATUS_IGNORE);
 
 	if (intok < 0) {
 	  std::cout << "Experiment " << exp_num
@@ -535,8 +852,8 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 	}
 
 	int n = expts[exp_num].NumMeasuredValues();
-	ParallelDescriptor::Recv( raw_data[exp_num],  current_worker, data_tag );
-	expts[exp_num].CopyData(current_worker,master, extra_tag);
+	MPI_Recv(DataPtr(raw_data[exp_num]), raw_data[exp_num].size(), real_type, current_worker, data_tag, wcomm, MPI_STATUS_IGNORE);
+	expts[exp_num].CopyData(ParallelGroups::GroupProc(current_worker),ParallelGroups::GroupProc(master), extra_tag);
 
 	// Use local data about where the results go to copy the output into the 
 	// test_measurements array
@@ -549,6 +866,7 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
       } else {
 	BoxLib::Abort("Unknown status from worker");
       }
+      profile_comm_time += ParallelDescriptor::second() - comm_time;
 
     } while (Nexperiments_dispatched < expts.size() && ok);
 
@@ -558,6 +876,7 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
     for (int i=first_worker; i<=last_worker; i++) {
 
       MPI_Recv(&worker_status, 1, MPI_INTEGER, i, control_tag, wcomm, MPI_STATUS_IGNORE);
+      Real comm_time = ParallelDescriptor::second();
 
       if (worker_status == READY) {
 	worker_command = STOP;
@@ -565,11 +884,12 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
       } 
       else if(worker_status == HAVE_RESULTS) {
 	// Deal with the results, then get - hopefully - "READY" and tell worker to stop
+	TraceScope trace("receive","mpi");
 	int exp_num;
 
-	ParallelDescriptor::Recv(&exp_num,1,i,data_tag);
-	ParallelDescriptor::Recv( &intok, 1, i, data_tag );
-	ParallelDescriptor::Recv( &msgID[exp_num], 1, i, data_tag );
+	MPI_Recv(&exp_num, 1, MPI_INT, i, data_tag, wcomm, MPI_STATUS_IGNORE);
+	MPI_Recv(&intok, 1, MPI_INT, i, data_tag, wcomm, MPI_STATUS_IGNORE);
+	MPI_Recv(&msgID[exp_num], 1, MPI_INT, i, data_tag, wcomm, MPI_STATUS_IGNORE);
 
 
 	if (intok < 0) {
@@ -580,8 +900,8 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 	}
 
 	int n = expts[exp_num].NumMeasuredValues();
-	ParallelDescriptor::Recv( raw_data[exp_num],  i, data_tag );
-	expts[exp_num].CopyData(i,master, extra_tag);
+	MPI_Recv(DataPtr(raw_data[exp_num]), raw_data[exp_num].size(), real_type, i, data_tag, wcomm, MPI_STATUS_IGNORE);
+	expts[exp_num].CopyData(ParallelGroups::GroupProc(i),ParallelGroups::GroupProc(master), extra_tag);
 	int offset = data_offsets[exp_num];
 
 	for (int j=0; j<n && (intok==1); ++j) {
@@ -596,6 +916,7 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
       else { 
 	BoxLib::Abort("Bad status from worker on cleanup loop");
       }
+      profile_comm_time += ParallelDescriptor::second() - comm_time;
     }
 
     // Done. 
@@ -611,15 +932,17 @@ ExperimentManager::EvaluateMeasurements_masterSlave(const std::vector<Real>& tes
 
   }
 
-  ParallelDescriptor::Barrier();
+  MPI_Barrier(wcomm);
   // All ranks should have the same result as at root to ensure they take a reasonable
   // path through sample space when driven by an external sampler
-  ParallelDescriptor::Bcast(const_cast<Real*>(&test_measurements[0]), 
-			    test_measurements.size(), 0);
+  MPI_Bcast(const_cast<Real*>(&test_measurements[0]), 
+	    test_measurements.size(), real_type, master, wcomm);
 
-  ParallelDescriptor::ReduceBoolAnd(ok);
+  int intok_all = ok;
+  MPI_Allreduce(MPI_IN_PLACE, &intok_all, 1, MPI_INT, MPI_LAND, wcomm);
+  ok = intok_all;
 
-  if (ParallelDescriptor::MyProc() == master)
+  if (ParallelGroups::MyProcInGroup() == master)
   {
     if (!ok) {
       if (log_failed_cases) {
@@ -652,7 +975,7 @@ ExperimentManager::EvaluateMeasurements_parallel(const std::vector<Real>& test_p
 {
   bool ok;
 
-  if (ParallelDescriptor::NProcs() == 1) {
+  if (ParallelGroups::GroupSize() == 1) {
     ok = EvaluateMeasurements_threaded(test_params, test_measurements);
   }
   else {
@@ -675,6 +998,7 @@ ExperimentManager::GenerateTestMeasurements(const std::vector<Real>& test_params
   test_measurements.resize(NumExptData());
 
   bool ok = true;
+  Real eval_time = ParallelDescriptor::second();
   if (parallel_mode == PARALLELIZE_OVER_RANK) {
 
     ok = EvaluateMeasurements_parallel(test_params, test_measurements);
@@ -683,6 +1007,18 @@ ExperimentManager::GenerateTestMeasurements(const std::vector<Real>& test_params
 
     ok = EvaluateMeasurements_threaded(test_params, test_measurements);
   }
+  eval_time = ParallelDescriptor::second() - eval_time;
+
+  // The ranks of a group share each sample, counted by the leader
+  if (ParallelGroups::GroupLeader()) {
+#ifdef _OPENMP
+#pragma omp critical (expt_profile)
+#endif
+    {
+      profile_samples++;
+      profile_eval_time += eval_time;
+    }
+  }
 
   return ok;
 }
@@ -693,52 +1029,205 @@ ExperimentManager::LogFailedCases(const std::vector<Real>& test_params,
                                   const std::vector<Real>& test_measurements,
                                   const std::vector<int>&  msgID)
 {
-  failure_number++;
+  // Failures of evaluations on concurrent threads are numbered and
+  // logged one at a time
+#ifdef _OPENMP
+#pragma omp critical (failed_cases)
+#endif
+  {
+    failure_number++;
+    Real log_time = ParallelDescriptor::second();
+
+    // Groups evaluating different samples log to folders of their own
+    BL_ASSERT(ParallelGroups::GroupLeader());
+    std::string log_folder_name = this->log_folder_name;
+    if (ParallelGroups::NGroups() > 1) {
+      log_folder_name = BoxLib::Concatenate(log_folder_name + "_",ParallelGroups::MyGroup(),4);
+    }
+    if (!BoxLib::UtilCreateDirectory(log_folder_name, 0755))
+      BoxLib::CreateDirectoryFailed(log_folder_name);
+
+    // First log entry in ascii table
+    std::string slog_file_name = log_folder_name + "/" + "FAILURE_LOG.txt";
+    std::ofstream sofs;
+    sofs.open(slog_file_name.c_str(), std::ios::out | std::ios::app);
+    sofs << failure_number << " ";
+    for (int i=0; i<msgID.size(); ++i) {
+      const std::string& msg = SimulatedExperiment::ErrorString(msgID[i]);
+      if (msg != "SUCCESS" && msg != "UNKNOWN") {
+        sofs << expt_name[i] << ":" << msg << " "; 
+      }
+    }
+    sofs << '\n';
+    sofs.close();
+
+    int ndigits = std::log10(failure_number) + 1;
+    const IntVect ivz(D_DECL(0,0,0));
 
-  BL_ASSERT(ParallelDescriptor::IOProcessor());
-  if (!BoxLib::UtilCreateDirectory(log_folder_name, 0755))
-    BoxLib::CreateDirectoryFailed(log_folder_name);
+    int np = test_params.size();
+    FArrayBox p(Box(ivz,ivz),np);
+    for (int i=0; i<np; ++i) {
+      p(ivz,i) = test_params[i];
+    }
+
+    std::string plog_file_name = log_folder_name + "/" + "params";
+    plog_file_name = BoxLib::Concatenate(plog_file_name,failure_number,ndigits);
+    std::ofstream pofs; pofs.open(plog_file_name.c_str());
+    p.writeOn(pofs);
+    pofs.close();
 
-  // First log entry in ascii table
-  std::string slog_file_name = log_folder_name + "/" + "FAILURE_LOG.txt";
-  std::ofstream sofs;
-  sofs.open(slog_file_name.c_str(), std::ios::out | std::ios::app);
-  sofs << failure_number << " ";
-  for (int i=0; i<msgID.size(); ++i) {
-    const std::string& msg = SimulatedExperiment::ErrorString(msgID[i]);
-    if (msg != "SUCCESS" && msg != "UNKNOWN") {
-      sofs << expt_name[i] << ":" << msg << " "; 
+    int nm = test_measurements.size();
+    FArrayBox m(Box(ivz,ivz),nm);
+    for (int i=0; i<nm; ++i) {
+      m(ivz,i) = test_measurements[i];
     }
+
+    std::string mlog_file_name = log_folder_name + "/" + "data";
+    mlog_file_name = BoxLib::Concatenate(mlog_file_name,failure_number,ndigits);
+    std::ofstream mofs; mofs.open(mlog_file_name.c_str());
+    m.writeOn(mofs);
+    mofs.close();
+
+    profile_log_time += ParallelDescriptor::second() - log_time;
   }
-  sofs << '\n';
-  sofs.close();
+}
 
-  int ndigits = std::log10(failure_number) + 1;
-  const IntVect ivz(D_DECL(0,0,0));
+const std::string&
+ExperimentManager::ProfileCounterName(int counter)
+{
+  static const std::string names[NUM_PROFILE_COUNTERS] = {
+    "evaluations", "failures", "retries", "wall_time",
+    "ode_intervals", "rhs_evals", "premix_solves", "premix_steps"
+  };
+  BL_ASSERT(counter >= 0 && counter < NUM_PROFILE_COUNTERS);
+  return names[counter];
+}
 
-  int np = test_params.size();
-  FArrayBox p(Box(ivz,ivz),np);
-  for (int i=0; i<np; ++i) {
-    p(ivz,i) = test_params[i];
+void
+ExperimentManager::ResetProfile()
+{
+  for (int i=0; i<profile.size(); ++i) {
+    std::fill(profile[i].begin(),profile[i].end(),0);
+    std::fill(profile_failures[i].begin(),profile_failures[i].end(),0);
   }
+  profile_samples = 0;
+  profile_eval_time = 0;
+  profile_comm_time = 0;
+  profile_log_time = 0;
+}
 
-  std::string plog_file_name = log_folder_name + "/" + "params";
-  plog_file_name = BoxLib::Concatenate(plog_file_name,failure_number,ndigits);
-  std::ofstream pofs; pofs.open(plog_file_name.c_str());
-  p.writeOn(pofs);
-  pofs.close();
+void
+ExperimentManager::ProfileEvaluation(int i, const std::pair<bool,int>& retVal,
+                                     int reruns, Real wall_time)
+{
+  const SolverCounters& counters = expts[i].Counters();
+#ifdef _OPENMP
+#pragma omp critical (expt_profile)
+#endif
+  {
+    std::vector<Real>& p = profile[i];
+    p[PROF_EVALUATIONS] += 1;
+    p[PROF_RETRIES] += reruns;
+    p[PROF_WALL_TIME] += wall_time;
+    p[PROF_ODE_INTERVALS] += counters.ode_intervals;
+    p[PROF_RHS_EVALS] += counters.rhs_evals;
+    p[PROF_PREMIX_SOLVES] += counters.premix_solves;
+    p[PROF_PREMIX_STEPS] += counters.premix_steps;
+    if (!retVal.first) {
+      p[PROF_FAILURES] += 1;
+      if (retVal.second >= 0 && retVal.second < profile_failures[i].size()) {
+        profile_failures[i][retVal.second] += 1;
+      }
+    }
+  }
+}
 
-  int nm = test_measurements.size();
-  FArrayBox m(Box(ivz,ivz),nm);
-  for (int i=0; i<nm; ++i) {
-    m(ivz,i) = test_measurements[i];
+// The profile summed over the ranks: a table on stdout, and one line
+// per experiment in profile_file,
+//   name evaluations failures ... premix_steps ERROR:count,...
+// after a header line naming the columns (- for no failures), then the
+// totals as "# key value" lines
+void
+ExperimentManager::WriteProfile() const
+{
+  int N = expts.size();
+  int nerr = SimulatedExperiment::ErrorMap().size();
+  std::vector<Real> sums;
+  for (int i=0; i<N; ++i) {
+    sums.insert(sums.end(),profile[i].begin(),profile[i].end());
+    sums.insert(sums.end(),profile_failures[i].begin(),profile_failures[i].end());
   }
+  sums.push_back(profile_samples);
+  sums.push_back(profile_eval_time);
+  sums.push_back(profile_comm_time);
+  sums.push_back(profile_log_time);
+  ParallelDescriptor::ReduceRealSum(&(sums[0]),sums.size());
+
+  if (!ParallelDescriptor::IOProcessor()) {
+    return;
+  }
+
+  int stride = NUM_PROFILE_COUNTERS + nerr;
+  const Real* totals = &(sums[N*stride]);
 
-  std::string mlog_file_name = log_folder_name + "/" + "data";
-  mlog_file_name = BoxLib::Concatenate(mlog_file_name,failure_number,ndigits);
-  std::ofstream mofs; mofs.open(mlog_file_name.c_str());
-  m.writeOn(mofs);
-  mofs.close();
+  std::cout << "================ EXPERIMENT PROFILE ================" << std::endl;
+  std::cout << totals[0] << " samples in " << totals[1] << " s, "
+            << totals[2] << " s in master/worker messages, "
+            << totals[3] << " s logging failed cases (summed over ranks)" << std::endl;
+  std::cout << std::setw(24) << std::left << "experiment" << std::right;
+  for (int c=0; c<NUM_PROFILE_COUNTERS; ++c) {
+    std::cout << std::setw(14) << ProfileCounterName(c);
+  }
+  std::cout << std::endl;
+  for (int i=0; i<N; ++i) {
+    const Real* p = &(sums[i*stride]);
+    std::cout << std::setw(24) << std::left << expt_name[i] << std::right;
+    for (int c=0; c<NUM_PROFILE_COUNTERS; ++c) {
+      std::cout << std::setw(14) << p[c];
+    }
+    std::cout << std::endl;
+    for (int e=0; e<nerr; ++e) {
+      if (p[NUM_PROFILE_COUNTERS+e] > 0) {
+        std::cout << std::setw(28) << " " << SimulatedExperiment::ErrorString(e)
+                  << ": " << p[NUM_PROFILE_COUNTERS+e] << std::endl;
+      }
+    }
+  }
+  std::cout << "====================================================" << std::endl;
+
+  if (profile_file != "") {
+    std::ofstream ofs(profile_file.c_str());
+    ofs << std::setprecision(12);
+    ofs << "name";
+    for (int c=0; c<NUM_PROFILE_COUNTERS; ++c) {
+      ofs << " " << ProfileCounterName(c);
+    }
+    ofs << " failure_codes\n";
+    for (int i=0; i<N; ++i) {
+      const Real* p = &(sums[i*stride]);
+      ofs << expt_name[i];
+      for (int c=0; c<NUM_PROFILE_COUNTERS; ++c) {
+        ofs << " " << p[c];
+      }
+      std::string codes;
+      for (int e=0; e<nerr; ++e) {
+        if (p[NUM_PROFILE_COUNTERS+e] > 0) {
+          std::ostringstream code;
+          code << (codes == "" ? "" : ",") << SimulatedExperiment::ErrorString(e)
+               << ":" << p[NUM_PROFILE_COUNTERS+e];
+          codes += code.str();
+        }
+      }
+      ofs << " " << (codes == "" ? "-" : codes) << '\n';
+    }
+    ofs << "# samples " << totals[0] << '\n';
+    ofs << "# eval_time " << totals[1] << '\n';
+    ofs << "# comm_time " << totals[2] << '\n';
+    ofs << "# log_time " << totals[3] << '\n';
+    if (!ofs.good()) {
+      BoxLib::Abort("ExperimentManager::WriteProfile: failed to write profile_file");
+    }
+  }
 }
 
 Real
@@ -782,115 +1271,278 @@ ExperimentManager::isgoodParamVal( Real k, std::vector<Real> & pvals, int idx ){
 
 }
 
-void 
-ExperimentManager::get_param_limits( Real * kmin, Real * kmax, Real * ktyp, Real tol, 
-                       std::vector<Real> & pvals, int idx){
-
-    double k1, k2, ktest, delt;
-
-    // First check right hand value - don't bother if it's ok
-    if( !isgoodParamVal( *kmax, pvals, idx) ) {
-        k2 = *kmax;
-        k1 = *ktyp;
-        do {
-            ktest = (k2+k1)*0.5;
-            if( isgoodParamVal( ktest, pvals, idx) ){
-                k1 = ktest;
-            }
-            else{
-                k2 = ktest;
-            }
-            delt = (k2-k1);
-        } while( delt > tol);
-        *kmax = k1;
-    }
-
-    if( !isgoodParamVal( *kmin, pvals, idx ) ){
-        k1 = *kmin;
-        k2 = *ktyp;
-        do {
-            ktest = (k2+k1)*0.5;
-            if( isgoodParamVal( ktest, pvals, idx) ){
-                k2 = ktest;
-            }
-            else{
-                k1 = ktest;
-            }
-            delt = (k2-k1);
-        } while( delt > tol);
-        *kmin = k2;
-
+void
+ExperimentManager::GenerateTestMeasurementsBatch(const std::vector<Real>& params, int n,
+                                                 std::vector<Real>&       measurements,
+                                                 std::vector<int>&        ok)
+{
+  int num_dvals = NumExptData();
+  measurements.resize((size_t)n * num_dvals);
+  ok.resize(n);
+  if (n == 0) {
+    return;
+  }
+  int num_params = params.size() / n;
+
+  // Each group takes a contiguous part of the batch, as in
+  // MCMCSampler::EvaluateBatch.  The samples of a group are evaluated
+  // one at a time, since they share the ChemDriver parameters (see
+  // Driver::LogLikelihoodBatch); the experiments of each go over the
+  // threads or the ranks of the group.  The status of sample s is
+  // stored after its measurements for the reduction.
+  int ngroups = ParallelGroups::NGroups();
+  int mygroup = ParallelGroups::MyGroup();
+  int begin = ((size_t)n*mygroup) / ngroups;
+  int end = ((size_t)n*(mygroup+1)) / ngroups;
+  std::vector<Real> result((size_t)n * (num_dvals+1), 0);
+  for (int s=begin; s<end; ++s) {
+    std::vector<Real> p(params.begin() + (size_t)s*num_params,
+                        params.begin() + (size_t)(s+1)*num_params);
+    std::vector<Real> d(num_dvals);
+    bool good = GenerateTestMeasurements(p,d);
+    Real* r = &(result[(size_t)s*(num_dvals+1)]);
+    for (int j=0; j<num_dvals; ++j) {
+      r[j] = d[j];
     }
+    r[num_dvals] = (good ? 1 : 0);
+  }
+  if (ngroups > 1) {
+    TraceScope trace("reduce measurements","mpi");
+    ParallelGroups::ReduceRealSumOverGroups(&(result[0]),result.size());
+  }
 
+  for (int s=0; s<n; ++s) {
+    const Real* r = &(result[(size_t)s*(num_dvals+1)]);
+    for (int j=0; j<num_dvals; ++j) {
+      measurements[(size_t)s*num_dvals + j] = r[j];
+    }
+    ok[s] = (r[num_dvals] > 0.5 ? 1 : 0);
+  }
 }
 
-void 
-ExperimentManager::get_param_interesting( Real * kmin, Real * kmax, Real * ktyp, Real tol, 
-                                          std::vector<Real> & pvals, int idx){
+// Points to place in each of nopen brackets per round: npoints if
+// set, else enough to give every group one (a batch is spread over
+// the groups only)
+static int
+PointsPerRound(int npoints, int nopen)
+{
+  if (npoints > 0) {
+    return npoints;
+  }
+  int ngroups = ParallelGroups::NGroups();
+  return std::max(1, (ngroups + nopen - 1) / nopen);
+}
 
-    double k1, k2, ktest, delt;
-
-    // First check right hand value - don't bother if it's ok
-    if( !isgoodParamVal( *kmax, pvals, idx) ) {
-        k2 = *kmax;
-        k1 = *ktyp;
-        do {
-            ktest = (k2+k1)*0.5;
-            if( isgoodParamVal( ktest, pvals, idx) ){
-                k1 = ktest;
-            }
-            else{
-                k2 = ktest;
-            }
-            delt = (k2-k1);
-        } while( delt > tol);
-        *kmax = k1;
-    }
-
-        {
-            double dlast, dmag;
-            int num_dvals = NumExptData();
-            std::vector<Real> dvals(num_dvals);
-            pvals[idx] = *kmax;
-            GenerateTestMeasurements(pvals, dvals);
-            dlast = dmag = dvals[0];
-            k1 = *kmax;
-            tol = dmag*0.1;
-            double dk = *kmax*0.01;
-            std::cout << " looking for change bigger than : " << tol << std::endl;
-            do {
-                int num_dvals = NumExptData();
-                std::vector<Real> dvals(num_dvals);
-                pvals[idx] = k1 - dk;
-                GenerateTestMeasurements(pvals, dvals);
-
-                delt = fabs( dlast - dvals[0] );
-                dlast = dvals[0];
-                if( delt < tol ) k1 = k1 -dk;
-                std::cout << " k1, dlast: " << k1 << "; " << dlast << std::endl;
-
-            } while( delt < tol );
-        }
-        *kmax = k1;
+namespace
+{
+  // Parameter p is valid at good and not at bad
+  struct Bracket
+  {
+    int p;
+    Real good, bad;
+  };
+}
 
-        // Start from kmax and shrink until just before interesting chanage
+void
+ExperimentManager::get_param_limits(std::vector<Real>&       kmin,
+                                    std::vector<Real>&       kmax,
+                                    const std::vector<Real>& ktyp,
+                                    Real                     tol,
+                                    const std::vector<Real>& pvals,
+                                    const std::vector<int>&  idx,
+                                    int                      npoints)
+{
+  int nparams = idx.size();
+  int num_params = pvals.size();
+  int num_dvals = NumExptData();
+  std::vector<Real> params, dvals;
+  std::vector<int> ok;
+
+  // First check the ends of the ranges - no search for the ones that
+  // are ok.  Brackets 2j and 2j+1 are the upper and lower ends of
+  // parameter j.
+  params.resize((size_t)2*nparams*num_params);
+  for (int j=0; j<nparams; ++j) {
+    for (int e=0; e<2; ++e) {
+      Real* p = &(params[(size_t)(2*j+e)*num_params]);
+      std::copy(pvals.begin(),pvals.end(),p);
+      p[idx[j]] = (e == 0 ? kmax[j] : kmin[j]);
+    }
+  }
+  GenerateTestMeasurementsBatch(params,2*nparams,dvals,ok);
 
+  std::vector<Bracket> open;
+  for (int b=0; b<2*nparams; ++b) {
+    bool good = ok[b];
+    for (int id=0; id<num_dvals && good; ++id) {
+      good = (dvals[(size_t)b*num_dvals + id] >= 0.0);
+    }
+    if (!good) {
+      Bracket br;
+      br.p = b;
+      br.good = ktyp[b/2];
+      br.bad = (b%2 == 0 ? kmax[b/2] : kmin[b/2]);
+      open.push_back(br);
+    }
+  }
 
-    if( !isgoodParamVal( *kmin, pvals, idx ) ){
-        k1 = *kmin;
-        k2 = *ktyp;
-        do {
-            ktest = (k2+k1)*0.5;
-            if( isgoodParamVal( ktest, pvals, idx) ){
-                k2 = ktest;
-            }
-            else{
-                k1 = ktest;
-            }
-            delt = (k2-k1);
-        } while( delt > tol);
-        *kmin = k2;
+  // k-section: each round places k points evenly inside every open
+  // bracket, and keeps the part between the last good point and the
+  // first bad one after it, 1/(k+1) of the bracket
+  for (int round=0; !open.empty(); ++round) {
+    int k = PointsPerRound(npoints,open.size());
+    int n = open.size() * k;
+    if (verbose && ParallelDescriptor::IOProcessor()) {
+      std::cout << "get_param_limits: round " << round << ", " << open.size()
+                << " brackets, " << n << " points" << std::endl;
+    }
+    params.resize((size_t)n*num_params);
+    for (int b=0; b<open.size(); ++b) {
+      const Bracket& br = open[b];
+      for (int i=0; i<k; ++i) {
+        Real* p = &(params[(size_t)(b*k + i)*num_params]);
+        std::copy(pvals.begin(),pvals.end(),p);
+        p[idx[br.p/2]] = br.good + (br.bad - br.good) * (i+1) / (k+1);
+      }
+    }
+    GenerateTestMeasurementsBatch(params,n,dvals,ok);
+
+    std::vector<Bracket> still_open;
+    for (int b=0; b<open.size(); ++b) {
+      Bracket br = open[b];
+      Real good = br.good;
+      Real bad = br.bad;
+      for (int i=0; i<k; ++i) {
+        int s = b*k + i;
+        Real ktest = params[(size_t)s*num_params + idx[br.p/2]];
+        bool isgood = ok[s];
+        for (int id=0; id<num_dvals && isgood; ++id) {
+          isgood = (dvals[(size_t)s*num_dvals + id] >= 0.0);
+        }
+        if (!isgood) {
+          bad = ktest;
+          break;
+        }
+        good = ktest;
+      }
+      br.good = good;
+      br.bad = bad;
+      if (std::abs(br.bad - br.good) > tol) {
+        still_open.push_back(br);
+      }
+      else if (br.p%2 == 0) {
+        kmax[br.p/2] = br.good;
+      }
+      else {
+        kmin[br.p/2] = br.good;
+      }
+    }
+    open.swap(still_open);
+  }
+}
 
+void
+ExperimentManager::get_param_interesting(std::vector<Real>&       kmin,
+                                         std::vector<Real>&       kmax,
+                                         const std::vector<Real>& ktyp,
+                                         Real                     tol,
+                                         const std::vector<Real>& pvals,
+                                         const std::vector<int>&  idx,
+                                         int                      npoints)
+{
+  get_param_limits(kmin,kmax,ktyp,tol,pvals,idx,npoints);
+
+  // Step down from kmax in 1% steps, for all the parameters at once,
+  // until the first measurement changes by more than 10% of its value
+  // at kmax.  Each round tries k steps of every parameter still
+  // stepping; the value at kmax goes with the first round.
+  int nparams = idx.size();
+  int num_params = pvals.size();
+  int num_dvals = NumExptData();
+  std::vector<Real> k1(kmax), dlast(nparams,0), dtol(nparams,0);
+  std::vector<int> stepping;
+  for (int j=0; j<nparams; ++j) {
+    stepping.push_back(j);
+  }
+  std::vector<Real> params, dvals;
+  std::vector<int> ok;
+  for (int round=0; !stepping.empty(); ++round) {
+    int k = PointsPerRound(npoints,stepping.size());
+    int first = (round == 0 ? 0 : 1);
+    std::vector<int> begin(stepping.size()), end(stepping.size());
+    params.clear();
+    int n = 0;
+    for (int m=0; m<stepping.size(); ++m) {
+      int j = stepping[m];
+      Real dk = kmax[j]*0.01;
+      begin[m] = n;
+      for (int i=first; i<=k; ++i) {
+        Real ktest = k1[j] - dk*i;
+        // Not past the bottom of the valid range
+        if (i > 0 && ktest < kmin[j]) {
+          break;
+        }
+        params.insert(params.end(),pvals.begin(),pvals.end());
+        params[(size_t)n*num_params + idx[j]] = ktest;
+        n++;
+      }
+      end[m] = n;
     }
+    GenerateTestMeasurementsBatch(params,n,dvals,ok);
+
+    std::vector<int> still_stepping;
+    for (int m=0; m<stepping.size(); ++m) {
+      int j = stepping[m];
+      Real dk = kmax[j]*0.01;
+      int s = begin[m];
+      if (round == 0) {
+        dlast[j] = dvals[(size_t)s*num_dvals];
+        dtol[j] = dlast[j]*0.1;
+        if (verbose && ParallelDescriptor::IOProcessor()) {
+          std::cout << " parameter " << idx[j] << ": looking for change bigger than : "
+                    << dtol[j] << std::endl;
+        }
+        s++;
+      }
+      bool done = (s == end[m] || !ok[begin[m]]);
+      for ( ; s<end[m] && !done; ++s) {
+        Real d = dvals[(size_t)s*num_dvals];
+        Real delt = std::abs(dlast[j] - d);
+        dlast[j] = d;
+        if (ok[s] && delt < dtol[j]) {
+          k1[j] -= dk;
+        }
+        else {
+          done = true;
+        }
+      }
+      if (!done) {
+        still_stepping.push_back(j);
+      }
+      else if (verbose && ParallelDescriptor::IOProcessor()) {
+        std::cout << " parameter " << idx[j] << ": k1, dlast: "
+                  << k1[j] << "; " << dlast[j] << std::endl;
+      }
+    }
+    stepping.swap(still_stepping);
+  }
+  kmax = k1;
+}
 
+void 
+ExperimentManager::get_param_limits( Real * kmin, Real * kmax, Real * ktyp, Real tol, 
+                                     std::vector<Real> & pvals, int idx){
+  std::vector<Real> kmin_v(1,*kmin), kmax_v(1,*kmax), ktyp_v(1,*ktyp);
+  get_param_limits(kmin_v,kmax_v,ktyp_v,tol,pvals,std::vector<int>(1,idx));
+  *kmin = kmin_v[0];
+  *kmax = kmax_v[0];
+}
+
+void 
+ExperimentManager::get_param_interesting( Real * kmin, Real * kmax, Real * ktyp, Real tol, 
+                                          std::vector<Real> & pvals, int idx){
+  std::vector<Real> kmin_v(1,*kmin), kmax_v(1,*kmax), ktyp_v(1,*ktyp);
+  get_param_interesting(kmin_v,kmax_v,ktyp_v,tol,pvals,std::vector<int>(1,idx));
+  *kmin = kmin_v[0];
+  *kmax = kmax_v[0];
 }
@@ -0,0 +1,199 @@
+#include <GPSurrogate.H>
+#include <Utility.H>
+
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+GPSurrogate::GPSurrogate(const std::vector<Real>& length_scale,
+                         int _max_points,
+                         Real _nugget)
+  : ndim(length_scale.size()), max_points(_max_points), npts(0),
+    nugget(_nugget), inv_length_scale(length_scale.size()), mean(0)
+{
+  if (max_points < 2) {
+    BoxLib::Abort("GPSurrogate: max_points must be at least 2");
+  }
+  for (int j=0; j<ndim; ++j) {
+    BL_ASSERT(length_scale[j] > 0);
+    inv_length_scale[j] = 1 / length_scale[j];
+  }
+  X.resize(max_points*ndim);
+  f.resize(max_points);
+  L.resize(max_points*max_points);
+  beta.resize(max_points);
+  alpha.resize(max_points);
+}
+
+Real
+GPSurrogate::Kernel(const Real* x, const Real* y) const
+{
+  Real r2 = 0;
+  for (int j=0; j<ndim; ++j) {
+    Real d = (x[j] - y[j]) * inv_length_scale[j];
+    r2 += d*d;
+  }
+  return std::exp(-0.5*r2);
+}
+
+// Extend the Cholesky factor by the row of x, against points
+// 0, ..., npts-1; returns false if x is (nearly) in their span
+bool
+GPSurrogate::Extend(const Real* x)
+{
+  Real* l = &(L[npts*max_points]);
+  Real d = 1 + nugget;
+  for (int i=0; i<npts; ++i) {
+    Real s = Kernel(x,&(X[i*ndim]));
+    const Real* Li = &(L[i*max_points]);
+    for (int k=0; k<i; ++k) {
+      s -= Li[k]*l[k];
+    }
+    l[i] = s / Li[i];
+    d -= l[i]*l[i];
+  }
+  if (d <= 100*nugget) {
+    return false;
+  }
+  l[npts] = std::sqrt(d);
+  return true;
+}
+
+void
+GPSurrogate::Refactor()
+{
+  int n = npts;
+  npts = 0;
+  for (int i=0; i<n; ++i) {
+    if (Extend(&(X[i*ndim]))) {
+      if (npts != i) {
+        for (int j=0; j<ndim; ++j) {
+          X[npts*ndim + j] = X[i*ndim + j];
+        }
+        f[npts] = f[i];
+      }
+      npts++;
+    }
+  }
+}
+
+// alpha = K^{-1} (f - mean) = L^{-T} L^{-1} (f - mean)
+void
+GPSurrogate::UpdateWeights()
+{
+  mean = 0;
+  for (int i=0; i<npts; ++i) {
+    mean += f[i];
+  }
+  mean /= npts;
+
+  for (int i=0; i<npts; ++i) {
+    const Real* Li = &(L[i*max_points]);
+    Real s = f[i] - mean;
+    for (int k=0; k<i; ++k) {
+      s -= Li[k]*beta[k];
+    }
+    beta[i] = s / Li[i];
+  }
+  for (int i=npts-1; i>=0; --i) {
+    Real s = beta[i];
+    for (int k=i+1; k<npts; ++k) {
+      s -= L[k*max_points + i]*alpha[k];
+    }
+    alpha[i] = s / L[i*max_points + i];
+  }
+}
+
+bool
+GPSurrogate::Add(const Real* x, Real fx)
+{
+  if (npts == max_points) {
+    // Keep the newer half
+    int nkeep = max_points / 2;
+    int first = npts - nkeep;
+    for (int i=0; i<nkeep; ++i) {
+      for (int j=0; j<ndim; ++j) {
+        X[i*ndim + j] = X[(first+i)*ndim + j];
+      }
+      f[i] = f[first+i];
+    }
+    npts = nkeep;
+    Refactor();
+  }
+
+  for (int j=0; j<ndim; ++j) {
+    X[npts*ndim + j] = x[j];
+  }
+  f[npts] = fx;
+  bool added = Extend(x);
+  if (added) {
+    npts++;
+  }
+  UpdateWeights();
+  return added;
+}
+
+// mean + k(x)^T K^{-1} (f - mean)
+Real
+GPSurrogate::operator()(const Real* x) const
+{
+  if (npts == 0) {
+    return 0;
+  }
+
+  Real result = mean;
+  for (int i=0; i<npts; ++i) {
+    result += Kernel(x,&(X[i*ndim])) * alpha[i];
+  }
+  return result;
+}
+
+std::string
+GPSurrogate::State() const
+{
+  std::ostringstream os;
+  os << std::setprecision(17);
+  os << "GPSurrogate " << ndim << " " << max_points << " " << npts << '\n';
+  for (int i=0; i<npts; ++i) {
+    for (int j=0; j<ndim; ++j) {
+      os << X[i*ndim + j] << " ";
+    }
+    os << f[i] << '\n';
+  }
+  return os.str();
+}
+
+// The points were all accepted in this order, so refactoring them
+// gives the same factor as adding them one at a time
+void
+GPSurrogate::SetState(const std::string& state)
+{
+  std::istringstream is(state);
+  std::string name;
+  int file_ndim, file_max_points, n;
+  is >> name >> file_ndim >> file_max_points >> n;
+  if (is.fail() || name != "GPSurrogate") {
+    BoxLib::Abort("GPSurrogate::SetState: bad state string");
+  }
+  if (file_ndim != ndim || file_max_points != max_points || n < 0 || n > max_points) {
+    BoxLib::Abort("GPSurrogate::SetState: state does not match the surrogate");
+  }
+  for (int i=0; i<n; ++i) {
+    for (int j=0; j<ndim; ++j) {
+      is >> X[i*ndim + j];
+    }
+    is >> f[i];
+  }
+  if (is.fail()) {
+    BoxLib::Abort("GPSurrogate::SetState: bad state string");
+  }
+  npts = n;
+  Refactor();
+  if (npts != n) {
+    BoxLib::Abort("GPSurrogate::SetState: points were not reproduced");
+  }
+  mean = 0;
+  if (npts > 0) {
+    UpdateWeights();
+  }
+}
@@ -204,7 +204,7 @@ Minimizer::FD_Hessian(void *p, const std::vector<Real>& X)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 MyMat
-Minimizer::InvSqrt(void *p, const MyMat & H)
+Minimizer::InvSqrt(void *p, const MyMat & H, bool regularize)
 {
   MINPACKstruct *str = (MINPACKstruct*)(p);
   int num_vals = str->parameter_manager.NumParams();
@@ -254,7 +254,7 @@ Minimizer::InvSqrt(void *p, const MyMat & H)
   std::vector<Real> sqrtlinv(num_vals);
   for (int i=0; i<num_vals; ++i) {
     if(eigenvalues[i] < CutOff){
-      sqrtlinv[i] = 0;
+      sqrtlinv[i] = (regularize ? 1 / std::sqrt(CutOff) : 0);
     }
     else{
       sqrtlinv[i] = 1 / std::sqrt(eigenvalues[i]);
@@ -365,6 +365,194 @@ static void grad(void * p, const std::vector<Real>& X, std::vector<Real>& gradF)
 #endif
   } 
 }
+
+void
+Minimizer::FD_Gradient(void *p, const std::vector<Real>& X, std::vector<Real>& gradF)
+{
+  gradF.resize(X.size());
+  grad(p,X,gradF);
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+
+// /////////////////////////////////////////////////////////
+// Hessian of the data misfit applied to a vector, using
+// forward differences of the gradient, with the gradient at
+// X supplied by the caller.  The prior part of F is
+// quadratic, so its contribution is removed exactly.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+static void
+misfit_hessian_vec(void* p, const std::vector<Real>& X, const std::vector<Real>& gradX,
+                   const std::vector<Real>& v, std::vector<Real>& Hv)
+{
+  MINPACKstruct *s = (MINPACKstruct*)(p);
+  ParameterManager& pm = s->parameter_manager;
+  const std::vector<Real>& prior_std = pm.PriorSTD();
+  int num_vals = pm.NumParams();
+
+  // Scale the step so that no component moves by more than
+  // the relative amount used for the finite-difference Hessian
+  Real vscale = 0;
+  for (int ii=0; ii<num_vals; ii++){
+    Real typ = std::max(pm.GetParameterTypical(ii), std::abs(X[ii]));
+    vscale = std::max(vscale, std::abs(v[ii])/typ);
+  }
+  if (vscale == 0) {
+    for (int ii=0; ii<num_vals; ii++){
+      Hv[ii] = 0;
+    }
+    return;
+  }
+  Real h = s->param_eps * 10 / vscale;
+
+  std::vector<Real> Xh(num_vals), gradXh(num_vals);
+  for (int ii=0; ii<num_vals; ii++){
+    Xh[ii] = X[ii] + h * v[ii];
+  }
+  if (check_bounds_in_Hessian) {
+    if (!parameters_in_bounds(p,num_vals,&(Xh[0]),true)) {
+      BoxLib::Warning("Hessian-vector product created parameters oob");
+    }
+  }
+  grad(p,Xh,gradXh);
+
+  for (int ii=0; ii<num_vals; ii++){
+    Hv[ii] = (gradXh[ii] - gradX[ii]) / h - v[ii] / (prior_std[ii] * prior_std[ii]);
+  }
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+
+// /////////////////////////////////////////////////////////
+// Low-rank plus diagonal approximation of the Hessian
+//
+// The Hessian of F is the prior precision D = diag(1/prior_std^2)
+// plus the Hessian of the data misfit.  We approximate the
+// prior-preconditioned misfit Hessian, D^{-1/2} Hm D^{-1/2}, with
+// a randomized range finder (Halko, Martinsson & Tropp), using
+// only Hessian-vector products, so that
+//
+//     H ~ D^{1/2} (I + W L W^T) D^{1/2}
+//
+// with W (n x rank) orthonormal.  The cost is
+// (2*(rank+oversample)+1)*2n evaluations of F, instead of the
+// O(n^2) needed by FD_Hessian.  The result is returned as a
+// dense matrix so that InvSqrt and the samplers can use it as is.
+// With verbose, the eigenvalues kept are printed on the IO rank.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+MyMat
+Minimizer::LowRank_Hessian(void *p, const std::vector<Real>& X, int rank, int oversample,
+                           bool verbose)
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+  str->ResizeWork();
+  int n = str->parameter_manager.NumParams();
+  const std::vector<Real>& prior_std = str->parameter_manager.PriorSTD();
+
+  int l = std::min(rank + oversample, n);
+  rank = std::min(rank, l);
+
+  std::vector<Real> gradX(n);
+  grad(p,X,gradX);
+
+  // Sample the range: Y = Hhat * Omega, Omega gaussian (column major, n x l)
+  std::vector<Real> Y(n*l);
+  std::vector<Real> v(n), Hv(n);
+  for (int k=0; k<l; ++k) {
+    for (int i=0; i<n; ++i) {
+      v[i] = prior_std[i] * randn();
+    }
+    misfit_hessian_vec(p,X,gradX,v,Hv);
+    for (int i=0; i<n; ++i) {
+      Y[i + k*n] = prior_std[i] * Hv[i];
+    }
+  }
+
+  // Orthonormal basis Q for the range of Y
+  std::vector<Real> tau(l);
+  lapack_int info = LAPACKE_dgeqrf(LAPACK_COL_MAJOR,n,l,&(Y[0]),n,&(tau[0]));
+  BL_ASSERT(info == 0);
+  info = LAPACKE_dorgqr(LAPACK_COL_MAJOR,n,l,l,&(Y[0]),n,&(tau[0]));
+  BL_ASSERT(info == 0);
+  const std::vector<Real>& Q = Y;
+
+  // Project: B = Q^T Hhat Q (l x l)
+  std::vector<Real> HQ(n*l);
+  for (int k=0; k<l; ++k) {
+    for (int i=0; i<n; ++i) {
+      v[i] = prior_std[i] * Q[i + k*n];
+    }
+    misfit_hessian_vec(p,X,gradX,v,Hv);
+    for (int i=0; i<n; ++i) {
+      HQ[i + k*n] = prior_std[i] * Hv[i];
+    }
+  }
+  std::vector<Real> B(l*l);
+  for (int j=0; j<l; ++j) {
+    for (int k=0; k<l; ++k) {
+      Real sum = 0;
+      for (int i=0; i<n; ++i) {
+        sum += Q[i + j*n] * HQ[i + k*n];
+      }
+      B[j + k*l] = sum;
+    }
+  }
+  // Symmetrize to remove finite-difference noise
+  for (int j=0; j<l; ++j) {
+    for (int k=j+1; k<l; ++k) {
+      Real avg = 0.5 * (B[j + k*l] + B[k + j*l]);
+      B[j + k*l] = avg;
+      B[k + j*l] = avg;
+    }
+  }
+
+  // Eigen-decomposition of the small matrix, eigenvalues ascending
+  std::vector<Real> lambda(l);
+  info = LAPACKE_dsyev(LAPACK_COL_MAJOR,'V','U',l,&(B[0]),l,&(lambda[0]));
+  BL_ASSERT(info == 0);
+
+  // Keep the leading rank eigenpairs, dropping negative ones
+  // (the misfit Hessian is positive semi-definite at the minimum)
+  std::vector<Real> W;
+  std::vector<Real> lam;
+  for (int k=l-1; k>=l-rank; --k) {
+    if (verbose && ParallelDescriptor::IOProcessor()) {
+      std::cout << "Low-rank Hessian eigenvalue: " << lambda[k] << std::endl;
+    }
+    if (lambda[k] <= 0) continue;
+    lam.push_back(lambda[k]);
+    for (int i=0; i<n; ++i) {
+      Real sum = 0;
+      for (int j=0; j<l; ++j) {
+        sum += Q[i + j*n] * B[j + k*l];
+      }
+      W.push_back(sum);
+    }
+  }
+  int r = lam.size();
+
+  // Assemble H = D^{1/2} (I + W L W^T) D^{1/2}
+  MyMat H(n);
+  for (int i=0; i<n; ++i) {
+    H[i].resize(n);
+    for (int j=0; j<n; ++j) {
+      Real val = (i==j ? 1 : 0);
+      for (int k=0; k<r; ++k) {
+        val += W[i + k*n] * lam[k] * W[j + k*n];
+      }
+      H[i][j] = val / (prior_std[i] * prior_std[j]);
+    }
+  }
+  return H;
+}
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -0,0 +1,91 @@
+#include <ParallelGroups.H>
+#include <ParallelDescriptor.H>
+#include <Utility.H>
+
+static bool is_split = false;
+static int group_size_split, my_group, group_size, my_proc_in_group;
+static MPI_Comm group_comm;
+
+void
+ParallelGroups::Split(int _group_size)
+{
+  int nprocs = ParallelDescriptor::NProcs();
+  int myproc = ParallelDescriptor::MyProc();
+  if (_group_size < 1 || _group_size > nprocs) {
+    BoxLib::Abort("ParallelGroups::Split: group size must be between 1 and the number of ranks");
+  }
+
+#ifdef BL_USE_MPI
+  if (is_split) {
+    MPI_Comm_free(&group_comm);
+  }
+  BL_MPI_REQUIRE( MPI_Comm_split(ParallelDescriptor::Communicator(),
+                                 myproc / _group_size, myproc, &group_comm) );
+  BL_MPI_REQUIRE( MPI_Comm_size(group_comm, &group_size) );
+  BL_MPI_REQUIRE( MPI_Comm_rank(group_comm, &my_proc_in_group) );
+#else
+  group_comm = ParallelDescriptor::Communicator();
+  group_size = 1;
+  my_proc_in_group = 0;
+#endif
+  group_size_split = _group_size;
+  my_group = myproc / _group_size;
+  is_split = true;
+}
+
+int
+ParallelGroups::NGroups()
+{
+  int nprocs = ParallelDescriptor::NProcs();
+  return (is_split ? (nprocs + group_size_split - 1) / group_size_split : 1);
+}
+
+int
+ParallelGroups::MyGroup()
+{
+  return (is_split ? my_group : 0);
+}
+
+int
+ParallelGroups::GroupSize()
+{
+  return (is_split ? group_size : ParallelDescriptor::NProcs());
+}
+
+int
+ParallelGroups::MyProcInGroup()
+{
+  return (is_split ? my_proc_in_group : ParallelDescriptor::MyProc());
+}
+
+bool
+ParallelGroups::GroupLeader()
+{
+  return (MyProcInGroup() == 0);
+}
+
+int
+ParallelGroups::GroupProc(int proc)
+{
+  return (is_split ? my_group * group_size_split + proc : proc);
+}
+
+MPI_Comm
+ParallelGroups::GroupCommunicator()
+{
+  return (is_split ? group_comm : ParallelDescriptor::Communicator());
+}
+
+void
+ParallelGroups::ReduceRealSumOverGroups(Real* r, int n)
+{
+  if (ParallelDescriptor::NProcs() == 1) {
+    return;
+  }
+  if (!GroupLeader()) {
+    for (int i=0; i<n; ++i) {
+      r[i] = 0;
+    }
+  }
+  ParallelDescriptor::ReduceRealSum(r,n);
+}
@@ -1,17 +1,225 @@
+#include <Rand.H>
 #include <Utility.H>
 #include <cmath>
+#include <cstring>
+#include <sstream>
+
+static uint64_t rand_seed = 0;
+static RandStream global_stream(0,0,RAND_TAG_GLOBAL);
+
+void SetRandSeed(uint64_t seed)
+{
+  rand_seed = seed;
+  global_stream.Reset(seed,0,RAND_TAG_GLOBAL);
+}
+
+uint64_t RandSeed()
+{
+  return rand_seed;
+}
 
 // ******************************************************
 // Generate uniformly distributed random number 
 Real drand() {
   //return (std::rand()+1.0)/(RAND_MAX+1.0);
-  return BoxLib::Random();
+  //return BoxLib::Random();
+  Real r;
+#ifdef _OPENMP
+#pragma omp critical (global_rand)
+#endif
+  r = global_stream.drand();
+  return r;
 }
   
 // Generate standard normal random number 
 Real randn(){
-  Real pi; 
-  pi =  3.14159265358979323846;
-  return std::sqrt(-2*std::log(drand())) * std::cos(2*pi*drand());
+  Real r;
+#ifdef _OPENMP
+#pragma omp critical (global_rand)
+#endif
+  r = global_stream.randn();
+  return r;
+}
+
+// ******************************************************
+// Philox4x32-10 (Salmon et al., SC'11)
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+static inline void
+philox_round(uint32_t* c, const uint32_t* k)
+{
+  uint64_t p0 = (uint64_t)PHILOX_M0 * c[0];
+  uint64_t p1 = (uint64_t)PHILOX_M1 * c[2];
+  uint32_t hi0 = (uint32_t)(p0 >> 32), lo0 = (uint32_t)p0;
+  uint32_t hi1 = (uint32_t)(p1 >> 32), lo1 = (uint32_t)p1;
+  c[0] = hi1 ^ c[1] ^ k[0];
+  c[1] = lo1;
+  c[2] = hi0 ^ c[3] ^ k[1];
+  c[3] = lo0;
+}
+
+RandStream::RandStream(uint64_t seed, uint64_t stream, uint32_t tag)
+{
+  Reset(seed,stream,tag);
+}
+
+void
+RandStream::Reset(uint64_t seed, uint64_t stream, uint32_t tag)
+{
+  key[0] = (uint32_t)seed;
+  key[1] = (uint32_t)(seed >> 32);
+  ctr[0] = 0;                      // Block counter within the stream
+  ctr[1] = tag;
+  ctr[2] = (uint32_t)stream;
+  ctr[3] = (uint32_t)(stream >> 32);
+  pos = 4;
+  have_normal = false;
+}
+
+void
+RandStream::Refill()
+{
+  uint32_t k[2] = {key[0], key[1]};
+  for (int i=0; i<4; ++i) {
+    buf[i] = ctr[i];
+  }
+  for (int r=0; r<10; ++r) {
+    philox_round(buf,k);
+    k[0] += PHILOX_W0;
+    k[1] += PHILOX_W1;
+  }
+  ctr[0]++;
+  pos = 0;
 }
 
+// 53 random bits from two 32-bit words, shifted off zero
+static inline Real
+to_unit_interval(uint32_t a, uint32_t b)
+{
+  return ((a >> 5) * 67108864.0 + (b >> 6) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+Real
+RandStream::drand()
+{
+  if (pos > 2) {
+    Refill();
+  }
+  Real r = to_unit_interval(buf[pos],buf[pos+1]);
+  pos += 2;
+  return r;
+}
+
+void
+RandStream::FillUniform(Real* x, int n)
+{
+  int i = 0;
+  // Finish the current block first
+  while (i < n && pos < 4) {
+    x[i++] = drand();
+  }
+  for ( ; i+1 < n; i+=2) {
+    Refill();
+    x[i]   = to_unit_interval(buf[0],buf[1]);
+    x[i+1] = to_unit_interval(buf[2],buf[3]);
+    pos = 4;
+  }
+  if (i < n) {
+    x[i] = drand();
+  }
+}
+
+void
+RandStream::FillNormal(Real* x, int n)
+{
+  int i = 0;
+  if (have_normal && n > 0) {
+    x[i++] = saved_normal;
+    have_normal = false;
+  }
+
+  // Box-Muller on pairs of uniforms, keeping both variates
+  int m = (n - i) & ~1;
+  FillUniform(x+i,m);
+  const Real twopi = 2*3.14159265358979323846;
+  for (int k=i; k<i+m; k+=2) {
+    Real r = std::sqrt(-2*std::log(x[k]));
+    Real theta = twopi*x[k+1];
+    x[k]   = r * std::cos(theta);
+    x[k+1] = r * std::sin(theta);
+  }
+
+  if (i+m < n) {
+    x[n-1] = randn();
+  }
+}
+
+Real
+RandStream::randn()
+{
+  if (have_normal) {
+    have_normal = false;
+    return saved_normal;
+  }
+  const Real pi = 3.14159265358979323846;
+  Real r = std::sqrt(-2*std::log(drand()));
+  Real theta = 2*pi*drand();
+  saved_normal = r * std::sin(theta);
+  have_normal = true;
+  return r * std::cos(theta);
+}
+
+std::string
+RandStream::State() const
+{
+  std::ostringstream os;
+  os << "Philox4x32";
+  for (int i=0; i<2; ++i) os << " " << key[i];
+  for (int i=0; i<4; ++i) os << " " << ctr[i];
+  os << " " << pos;
+  // The cached second normal of a Box-Muller pair, bit for bit
+  uint64_t bits = 0;
+  if (have_normal) {
+    std::memcpy(&bits,&saved_normal,sizeof(Real));
+  }
+  os << " " << (have_normal ? 1 : 0) << " " << bits;
+  return os.str();
+}
+
+void
+RandStream::SetState(const std::string& state)
+{
+  std::istringstream is(state);
+  std::string name;
+  is >> name;
+  if (name != "Philox4x32") {
+    BoxLib::Abort("RandStream::SetState: unrecognized state string");
+  }
+  for (int i=0; i<2; ++i) is >> key[i];
+  for (int i=0; i<4; ++i) is >> ctr[i];
+  int newpos; is >> newpos;
+  if (is.fail()) {
+    BoxLib::Abort("RandStream::SetState: bad state string");
+  }
+  // States written before the cached normal was saved end here
+  int hn = 0;
+  uint64_t bits = 0;
+  if (is >> hn) {
+    is >> bits;
+    if (is.fail()) {
+      BoxLib::Abort("RandStream::SetState: bad state string");
+    }
+  }
+  have_normal = (hn != 0);
+  std::memcpy(&saved_normal,&bits,sizeof(Real));
+  pos = 4;
+  if (newpos < 4) {
+    // Regenerate the block that was partially consumed
+    ctr[0]--;
+    Refill();
+    pos = newpos;
+  }
+}
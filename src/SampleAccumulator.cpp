@@ -0,0 +1,115 @@
+#include <SampleAccumulator.H>
+#include <Rand.H>
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+SampleAccumulator::SampleAccumulator(int num_params, int resample_size)
+  : nparams(num_params), nsamples(0), nfailed(0),
+    ref(std::numeric_limits<Real>::infinity()), W(0), W2(0),
+    mean(num_params,0), C(num_params*num_params,0),
+    reservoir(resample_size,num_params,0)
+{}
+
+// Move the reference negative log weight down to nlw
+void
+SampleAccumulator::Rescale(Real nlw)
+{
+  if (W > 0) {
+    Real f = std::exp(-(ref - nlw));
+    W *= f;
+    W2 *= f*f;
+    for (int j=0; j<C.size(); ++j) {
+      C[j] *= f;
+    }
+  }
+  ref = nlw;
+}
+
+void
+SampleAccumulator::Add(const Real* x, Real nlw, int sampleID)
+{
+  nsamples++;
+  if (nlw == std::numeric_limits<Real>::infinity()) {
+    nfailed++;
+    return;
+  }
+  if (nlw < ref) {
+    Rescale(nlw);
+  }
+  Real w = std::exp(-(nlw - ref));
+  W += w;
+  W2 += w*w;
+
+  // Weighted Welford update, C += w (x - mean_old)(x - mean_new)^T
+  Real r = w / W;
+  std::vector<Real> d(nparams);
+  for (int j=0; j<nparams; ++j) {
+    d[j] = x[j] - mean[j];
+    mean[j] += r * d[j];
+  }
+  for (int j=0; j<nparams; ++j) {
+    Real wdj = w * d[j] * (1 - r);
+    Real* row = &(C[j*nparams]);
+    for (int k=j; k<nparams; ++k) {
+      row[k] += wdj * d[k];
+    }
+  }
+
+  // Each slot takes this sample with probability w/W.  The slots that
+  // do are found by geometric skips, so the cost per sample is
+  // proportional to the number of slots replaced.
+  int nslots = reservoir.NumSamples();
+  if (nslots > 0) {
+    if (r >= 1) {
+      for (int k=0; k<nslots; ++k) {
+        reservoir.SetSample(k,x);
+      }
+    }
+    else {
+      RandStream rs(RandSeed(),sampleID,RAND_TAG_RESERVOIR);
+      Real log1mr = std::log(1 - r);
+      Real k = std::floor(std::log(rs.drand()) / log1mr);
+      while (k < nslots) {
+        reservoir.SetSample((int)k,x);
+        k += 1 + std::floor(std::log(rs.drand()) / log1mr);
+      }
+    }
+  }
+}
+
+Real
+SampleAccumulator::EffSampleSize() const
+{
+  return (W2 > 0 ? W*W/W2 : 0);
+}
+
+Real
+SampleAccumulator::CompR() const
+{
+  return (W > 0 ? nsamples*W2/(W*W) : 0);
+}
+
+void
+SampleAccumulator::Var(std::vector<Real>& var) const
+{
+  var.resize(nparams);
+  for (int j=0; j<nparams; ++j) {
+    var[j] = (W > 0 ? C[j*nparams+j]/W : 0);
+  }
+}
+
+void
+SampleAccumulator::Cov(std::vector<std::vector<Real> >& cov) const
+{
+  cov.resize(nparams);
+  for (int j=0; j<nparams; ++j) {
+    cov[j].resize(nparams);
+    for (int k=0; k<nparams; ++k) {
+      int jj = std::min(j,k);
+      int kk = std::max(j,k);
+      cov[j][k] = (W > 0 ? C[jj*nparams+kk]/W : 0);
+    }
+  }
+}
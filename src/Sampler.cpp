@@ -1,298 +1,699 @@
 #include <Driver.H>
 #include <Sampler.H>
+#include <ParallelDescriptor.H>
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <limits>
+#include <map>
 
 #ifdef _OPENMP
 #include "omp.h"
 #endif
 
-PriorMCSampler::PriorMCSampler(const std::vector<Real>& prior_mean_,
-                               const std::vector<Real>& prior_std_)
-  : prior_mean(prior_mean_), prior_std(prior_std_)
-{}
+extern "C" {
+  void dgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+              const double* alpha, const double* a, const int* lda, const double* b, const int* ldb,
+              const double* beta, double* c, const int* ldc);
+}
 
-void
-PriorMCSampler::Sample(void* p, std::vector<std::vector<Real> >& samples, std::vector<Real>& w) const
-{
-  MINPACKstruct *str = (MINPACKstruct*)(p);
-  str->ResizeWork();
-	  
-  int num_params = str->parameter_manager.NumParams();
-  int NOS = samples.size();
+// Number of samples whose proposals are generated together
+static int proposal_block_size = 1024;
 
-  std::vector<Real> sample_data(str->expt_manager.NumExptData());
-  std::vector<Real> s(num_params);
-  
-  std::cout <<  " " << std::endl;
-  std::cout <<  "Start sampling with prior " << std::endl;
-  std::cout <<  "Number of samples: " << NOS << std::endl;
+// Reductions over samples are done in blocks of fixed size, and the
+// partial sums of the blocks are added in order, so the statistics
+// do not depend on the number of threads
+static const int reduction_block_size = 4096;
 
-  const std::vector<Real>& upper_bound = str->parameter_manager.UpperBound();
-  const std::vector<Real>& lower_bound = str->parameter_manager.LowerBound();
+static int
+num_reduction_blocks(int NOS)
+{
+  return (NOS + reduction_block_size - 1) / reduction_block_size;
+}
 
-  for(int ii=0; ii<NOS; ii++){
-    BL_ASSERT(samples[ii].size()==num_params);
-    for(int jj=0; jj<num_params; jj++){
-      samples[ii][jj] = prior_mean[jj] + prior_std[jj]*randn();
-      bool sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+// Sum of v (or of v^2, if square)
+static Real
+ordered_sum(const Real* v, int N, bool square)
+{
+  int nblocks = num_reduction_blocks(N);
+  std::vector<Real> partial(nblocks,0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    int iEnd = std::min(N,(iblock+1)*reduction_block_size);
+    Real sum = 0;
+    for (int ii=iblock*reduction_block_size; ii<iEnd; ++ii) {
+      sum += (square ? v[ii]*v[ii] : v[ii]);
+    }
+    partial[iblock] = sum;
+  }
+  Real sum = 0;
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    sum += partial[iblock];
+  }
+  return sum;
+}
 
-      while (sample_oob) {
-        std::cout <<  "sample is out of bounds, parameter " << jj
-                  << " val,lb,ub: " << samples[ii][jj]
-                  << ", " << lower_bound[jj] << ", " << upper_bound[jj] << std::endl;
-        samples[ii][jj] = prior_mean[jj] + prior_std[jj]*randn();
-        sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+// result_j = sum_i w_i x_ij, with w_i = w[i] or, if w is null, wconst
+static void
+weighted_sum(std::vector<Real>&  result,
+             const Real*         w,
+             Real                wconst,
+             const SampleMatrix& samples)
+{
+  int NOS = samples.NumSamples();
+  int n = samples.NumParams();
+  int nblocks = num_reduction_blocks(NOS);
+  std::vector<Real> partial((size_t)nblocks*n,0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    Real* sum = &(partial[(size_t)iblock*n]);
+    int iEnd = std::min(NOS,(iblock+1)*reduction_block_size);
+    for (int ii=iblock*reduction_block_size; ii<iEnd; ++ii) {
+      const Real* x = samples[ii];
+      Real wi = (w ? w[ii] : wconst);
+      for (int jj=0; jj<n; ++jj) {
+        sum[jj] += wi*x[jj];
       }
     }
   }
+  result.assign(n,0);
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    for (int jj=0; jj<n; ++jj) {
+      result[jj] += partial[(size_t)iblock*n + jj];
+    }
+  }
+}
 
+// result_j = sum_i w_i (x_ij - m_j)^2, with w_i as above
+static void
+weighted_sum_squares(std::vector<Real>&       result,
+                     const std::vector<Real>& m,
+                     const Real*              w,
+                     Real                     wconst,
+                     const SampleMatrix&      samples)
+{
+  int NOS = samples.NumSamples();
+  int n = samples.NumParams();
+  int nblocks = num_reduction_blocks(NOS);
+  BL_ASSERT(m.size() == n);
+  std::vector<Real> partial((size_t)nblocks*n,0);
 #ifdef _OPENMP
-  int tnum = omp_get_max_threads();
-  BL_ASSERT(tnum>0);
-  std::cout <<  " number of threads: " << tnum << std::endl;
-  int logPeriod = 1000;
-#else
-  int tnum = 1;
+#pragma omp parallel for
 #endif
-  Real dthread = NOS / Real(tnum);
-  std::vector<int> trange(tnum);
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    trange[ithread] = ithread * dthread;
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    Real* sum = &(partial[(size_t)iblock*n]);
+    const Real* mp = &(m[0]);
+    int iEnd = std::min(NOS,(iblock+1)*reduction_block_size);
+    for (int ii=iblock*reduction_block_size; ii<iEnd; ++ii) {
+      const Real* x = samples[ii];
+      Real wi = (w ? w[ii] : wconst);
+      for (int jj=0; jj<n; ++jj) {
+        Real d = x[jj] - mp[jj];
+        sum[jj] += wi*d*d;
+      }
+    }
+  }
+  result.assign(n,0);
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    for (int jj=0; jj<n; ++jj) {
+      result[jj] += partial[(size_t)iblock*n + jj];
+    }
+  }
+}
+
+// /////////////////////////////////////////////////////////
+// Standard normals of the proposal of sample sampleID: the
+// sample's Sobol point if qmc is set, otherwise its own random
+// stream
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+static void
+proposal_normals(const ScrambledSobol* qmc, int sampleID, Real* z, int n)
+{
+  if (qmc != 0) {
+    BL_ASSERT(qmc->Dim() == n);
+    qmc->Normal(sampleID,z);
+  }
+  else {
+    RandStream rs(RandSeed(),sampleID,RAND_TAG_PROPOSAL);
+    rs.FillNormal(z,n);
+  }
+}
+
+// /////////////////////////////////////////////////////////
+// Proposals of the linear map, x = mu + L z, z standard normal,
+// for samples sampleOffset, sampleOffset+1, ...  Each sample
+// draws z from its own random stream.  Samples are processed in
+// blocks, with the map applied to a whole block as one
+// matrix-matrix product.  The standard normals are scrambled
+// Sobol points if qmc is set.  Samples out of bounds are redrawn
+// whole from a retry stream (if symmetric, the mirrored sample
+// 2 mu - x must be in bounds as well), unless oob is given, in
+// which case they are kept as drawn and flagged in oob.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+static void
+linear_map_proposals(const std::vector<Real>&         mu,
+                     const MyMat&                     L,
+                     const std::vector<Real>&         lower_bound,
+                     const std::vector<Real>&         upper_bound,
+                     bool                             symmetric,
+                     int                              sampleOffset,
+                     const ScrambledSobol*            qmc,
+                     SampleMatrix&                    samples,
+                     std::vector<int>*                oob = 0)
+{
+  int n = mu.size();
+  int NOS = samples.size();
+  int nblocks = (NOS + proposal_block_size - 1) / proposal_block_size;
+
+  // Column-major copy of L for BLAS
+  std::vector<Real> Lc(n*n);
+  for (int j=0; j<n; ++j) {
+    for (int k=0; k<n; ++k) {
+      Lc[j + k*n] = L[j][k];
+    }
   }
 
-  std::cout <<  "Generating samples";
 #ifdef _OPENMP
-  std::cout << " using " << tnum << " threads";
+#pragma omp parallel for schedule(dynamic,1)
 #endif
-  std::cout << std::endl;
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    int iBegin = iblock * proposal_block_size;
+    int nb = std::min(proposal_block_size, NOS - iBegin);
+
+    std::vector<Real> Z(n*nb), X(n*nb);
+    for (int ib=0; ib<nb; ++ib) {
+      proposal_normals(qmc,sampleOffset+iBegin+ib,&(Z[ib*n]),n);
+    }
+
+    const char trans = 'N';
+    const Real one = 1, zero = 0;
+    dgemm_(&trans,&trans,&n,&nb,&n,&one,&(Lc[0]),&n,&(Z[0]),&n,&zero,&(X[0]),&n);
+
+    for (int ib=0; ib<nb; ++ib) {
+      int ii = iBegin + ib;
+      Real* x = &(X[ib*n]);
+
+      bool sample_oob = false;
+      for (int jj=0; jj<n; ++jj) {
+        samples[ii][jj] = mu[jj] + x[jj];
+        sample_oob |= (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+        if (symmetric) {
+          Real neg = mu[jj] - x[jj];
+          sample_oob |= (neg < lower_bound[jj] || neg > upper_bound[jj]);
+        }
+      }
 
+      if (oob != 0) {
+        (*oob)[ii] = sample_oob;
+      }
+      else if (sample_oob) {
+        RandStream rs(RandSeed(),sampleOffset+ii,RAND_TAG_RETRY);
+        Real* z = &(Z[ib*n]);
+        while (sample_oob) {
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp critical (sampler_log)
 #endif
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    int iBegin = trange[ithread];
-    int iEnd = (ithread==tnum-1 ? NOS : trange[ithread+1]);
+          std::cout <<  "sample " << sampleOffset+ii << " is out of bounds, redrawing" << std::endl;
+
+          rs.FillNormal(z,n);
+          sample_oob = false;
+          for (int jj=0; jj<n; ++jj) {
+            Real Lz = 0;
+            for (int kk=0; kk<n; ++kk) {
+              Lz += L[jj][kk]*z[kk];
+            }
+            samples[ii][jj] = mu[jj] + Lz;
+            sample_oob |= (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+            if (symmetric) {
+              Real neg = mu[jj] - Lz;
+              sample_oob |= (neg < lower_bound[jj] || neg > upper_bound[jj]);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
 
-    for(int ii=iBegin; ii<iEnd; ii++){
+// /////////////////////////////////////////////////////////
+// Evaluate samples sampleOffset, ..., sampleOffset+NOS-1 with
+// SampleChunk, in chunks of chunk_size.
+//
+// With more than one MPI rank, the IO processor hands out chunks
+// to the other ranks as they become free, and collects the
+// results.  Each rank evaluates its samples alone (experiments
+// parallelized over threads).  Chunks may finish out of order;
+// they are held back until all earlier chunks are in, so that
+// the handler sees the samples in order, whatever the number of
+// ranks.  The handler is only called on the IO processor.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::EvaluateChunks(void* p, int sampleOffset, int NOS, int chunk_size,
+                        ChunkHandler& handler) const
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+  str->ResizeWork();
 
-#ifdef _OPENMP
-      if (ithread == 0) {
-        if ( (ii - iBegin)%logPeriod == 0 ) {
-          std::cout << " Completed "<< ii - iBegin << " samples on thread 0" << std::endl;          
+  int num_params = str->parameter_manager.NumParams();
+  BL_ASSERT(chunk_size > 0);
+  int nchunks = (NOS + chunk_size - 1) / chunk_size;
+  int nprocs = ParallelDescriptor::NProcs();
+
+  ExperimentManager::PARALLEL_MODE parallel_mode = str->expt_manager.GetParallelMode();
+  if (nprocs > 1) {
+    str->expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_THREAD);
+  }
+
+  SampleMatrix chunk;
+  std::vector<Real> nlw;
+
+#ifdef BL_USE_MPI
+  if (nprocs > 1) {
+    const int control_tag = 100;
+    const int data_tag = 101;
+    MPI_Comm wcomm = ParallelDescriptor::Communicator();
+    int master = ParallelDescriptor::IOProcessorNumber();
+
+    if (ParallelDescriptor::IOProcessor()) {
+      typedef std::map<int, std::pair<SampleMatrix, std::vector<Real> > > PendingMap;
+      PendingMap pending;
+      int next_in_order = 0;
+
+      // Workers report the chunk they finished (-1 if none), and get
+      // the next chunk to do (-1 when there are no more)
+      int next_chunk = 0;
+      int nworking = nprocs - 1;
+      while (nworking > 0) {
+        MPI_Status status;
+        int done;
+        MPI_Recv(&done, 1, MPI_INT, MPI_ANY_SOURCE, control_tag, wcomm, &status);
+        int worker = status.MPI_SOURCE;
+
+        if (done >= 0) {
+          int nb = std::min(chunk_size, NOS - done*chunk_size);
+          std::pair<SampleMatrix, std::vector<Real> >& res = pending[done];
+          res.first.resize(nb,num_params);
+          res.second.resize(nb);
+          ParallelDescriptor::Recv(res.first.dataPtr(), nb*num_params, worker, data_tag);
+          ParallelDescriptor::Recv(&(res.second[0]), nb, worker, data_tag);
+
+          PendingMap::iterator it;
+          while ( (it = pending.find(next_in_order)) != pending.end() ) {
+            handler.Add(sampleOffset + next_in_order*chunk_size, it->second.first, it->second.second);
+            pending.erase(it);
+            next_in_order++;
+          }
+        }
+
+        int command = -1;
+        if (next_chunk < nchunks) {
+          command = next_chunk++;
         }
+        else {
+          nworking--;
+        }
+        MPI_Send(&command, 1, MPI_INT, worker, control_tag, wcomm);
       }
+      BL_ASSERT(pending.empty());
+    }
+    else {
+      int ichunk = -1;
+      do {
+        MPI_Send(&ichunk, 1, MPI_INT, master, control_tag, wcomm);
+        if (ichunk >= 0) {
+          ParallelDescriptor::Send(chunk.dataPtr(), chunk.NumSamples()*num_params, master, data_tag);
+          ParallelDescriptor::Send(&(nlw[0]), nlw.size(), master, data_tag);
+        }
+
+        MPI_Recv(&ichunk, 1, MPI_INT, master, control_tag, wcomm, MPI_STATUS_IGNORE);
+        if (ichunk >= 0) {
+          int iBegin = ichunk * chunk_size;
+          int nb = std::min(chunk_size, NOS - iBegin);
+          chunk.resize(nb,num_params);
+          nlw.resize(nb);
+          SampleChunk(p,sampleOffset+iBegin,chunk,nlw);
+        }
+      } while (ichunk >= 0);
+    }
+  }
+  else
 #endif
+  {
+    for (int ichunk=0; ichunk<nchunks; ++ichunk) {
+      int iBegin = ichunk * chunk_size;
+      int nb = std::min(chunk_size, NOS - iBegin);
+      chunk.resize(nb,num_params);
+      nlw.resize(nb);
+      SampleChunk(p,sampleOffset+iBegin,chunk,nlw);
+      handler.Add(sampleOffset+iBegin,chunk,nlw);
+    }
+  }
 
-      bool ok = str->expt_manager.GenerateTestMeasurements(samples[ii],sample_data);
-      w[ii] = (ok ? str->expt_manager.ComputeLikelihood(sample_data) : -1);
+  str->expt_manager.SetParallelMode(parallel_mode);
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+// /////////////////////////////////////////////////////////
+// Adds finished chunks to the accumulator and the samples file,
+// and reports the running effective sample size.  With QMC
+// replicates, each sample is also added to the accumulator of its
+// replicate.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+struct StreamingChunkHandler
+  : public Sampler::ChunkHandler
+{
+  StreamingChunkHandler(SampleAccumulator& _acc,
+                        std::vector<Real>& _w,
+                        SampleMatrix*      _samples,
+                        std::ostream&      _os,
+                        const ScrambledSobol* _qmc = 0,
+                        std::vector<SampleAccumulator>* _replicates = 0)
+    : acc(_acc), w(_w), samples(_samples), os(_os),
+      qmc(_qmc), replicates(_replicates) {}
+
+  virtual void Add(int iBegin, const SampleMatrix& chunk, const std::vector<Real>& nlw)
+  {
+    int num_params = chunk.NumParams();
+    for (int ib=0; ib<chunk.NumSamples(); ++ib) {
+      int ii = iBegin + ib;
+      acc.Add(chunk[ib],nlw[ib],ii);
+      if (replicates != 0) {
+        (*replicates)[qmc->Replicate(ii)].Add(chunk[ib],nlw[ib],ii);
+      }
+      w[ii] = nlw[ib];
+      if (samples != 0) {
+        samples->SetSample(ii,chunk[ib]);
+      }
+      for (int jj=0; jj<num_params; jj++) {
+        os << chunk[ib][jj] << " ";
+      }
+      os << '\n';
     }
+    os.flush();
+
+    std::cout << " Completed " << acc.NumSamples() << " samples ("
+              << acc.NumFailed() << " failed), effective sample size = "
+              << acc.EffSampleSize() << std::endl;
   }
 
+  SampleAccumulator& acc;
+  std::vector<Real>& w;
+  SampleMatrix* samples;
+  std::ostream& os;
+  const ScrambledSobol* qmc;
+  std::vector<SampleAccumulator>* replicates;
+};
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
 
-  Real wmin = w[0];
-  for(int ii=0; ii<NOS; ii++){
-    wmin = std::min(w[ii],wmin);
+// /////////////////////////////////////////////////////////
+// Report the conditional mean estimated from independent QMC
+// replicates, with its standard error from the spread of the
+// replicate estimates
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+static void
+report_replicates(const std::vector<SampleAccumulator>& replicates)
+{
+  int num_params = replicates[0].NumParams();
+  std::vector<Real> sum(num_params,0), sum2(num_params,0);
+  int R = 0;
+  for (int r=0; r<replicates.size(); ++r) {
+    if (replicates[r].NumSamples() > replicates[r].NumFailed()) {
+      const std::vector<Real>& m = replicates[r].Mean();
+      for (int jj=0; jj<num_params; ++jj) {
+        sum[jj] += m[jj];
+        sum2[jj] += m[jj]*m[jj];
+      }
+      R++;
+    }
   }
-  for(int ii=0; ii<NOS; ii++){
-    w[ii] = (w[ii] == -1 ? 0 : std::exp(-(w[ii] - wmin)));
-    //std::cout << "w before = "<< w[ii] << std::endl;
+
+  std::cout << "QMC replicates with successful samples: " << R << std::endl;
+  if (R < 2) {
+    return;
+  }
+  for (int jj=0; jj<num_params; ++jj) {
+    Real mean = sum[jj] / R;
+    Real var = std::max(Real(0), (sum2[jj] - R*mean*mean) / (R - 1));
+    std::cout << "Conditional mean over replicates = " << mean
+              << " +/- " << std::sqrt(var / R) << std::endl;
+  }
+  std::cout << " " << std::endl;
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+// /////////////////////////////////////////////////////////
+// Sample in chunks.  Each chunk is proposed and evaluated by the
+// sampler, then added to the accumulator and written to the
+// samples file, and the running effective sample size is
+// reported.  The negative log weights of all samples are kept,
+// to write the normalized weights at the end.  The accumulator
+// and the samples are only filled on the IO processor; the
+// normalized weights are broadcast to all ranks.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::Sample(void* p, SampleAccumulator& acc, std::vector<Real>& w,
+                int chunk_size, SampleMatrix* samples) const
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+  int num_params = str->parameter_manager.NumParams();
+  int NOS = w.size();
+  BL_ASSERT(acc.NumParams() == num_params);
+
+  bool ioproc = ParallelDescriptor::IOProcessor();
+  std::ofstream of;
+  if (ioproc) {
+    if (samples != 0) {
+      samples->resize(NOS,num_params);
+    }
+    PrintHeader(NOS);
+
+    std::stringstream SampleStr;
+    SampleStr<<Name()<<"Samples.dat";
+    of.open(SampleStr.str().c_str());
+    of << std::setprecision(20);
+  }
+
+  std::vector<SampleAccumulator> replicates;
+  if (qmc != 0 && qmc->NumReplicates() > 1) {
+    replicates.resize(qmc->NumReplicates(),SampleAccumulator(num_params));
+  }
+
+  StreamingChunkHandler handler(acc,w,samples,of,qmc,
+                                replicates.empty() ? 0 : &replicates);
+  EvaluateChunks(p,0,NOS,chunk_size,handler);
+
+  if (ioproc) {
+    of.close();
+    NormalizeLogWeights(w);
+    if (!replicates.empty()) {
+      report_replicates(replicates);
+    }
+    Summarize(acc,w);
   }
 
-  // Normalize weights, print to terminal
-  NormalizeWeights(w);
-  
-  // Approximate effective sample size and quality measure R	
-  Real Neff = EffSampleSize(w,NOS);
+  ParallelDescriptor::Bcast(&(w[0]), NOS, ParallelDescriptor::IOProcessorNumber());
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+// /////////////////////////////////////////////////////////
+// Print the name of the sampler and how it runs
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::PrintHeader(int NOS) const
+{
+  int nprocs = ParallelDescriptor::NProcs();
   std::cout <<  " " << std::endl;
-  std::cout <<  "Effective sample size = "<< Neff << std::endl;
-  Real R = CompR(w,NOS);
-  std::cout <<  "Quality measure R =  "<< R << std::endl;
+  std::cout <<  "Starting " << Name() << std::endl;
+  std::cout <<  "Number of samples: " << NOS << std::endl;
+  if (nprocs > 1) {
+    std::cout <<  " number of worker ranks: " << nprocs - 1 << std::endl;
+  }
+#ifdef _OPENMP
+  std::cout <<  " number of threads: " << omp_get_max_threads() << std::endl;
+#endif
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+// /////////////////////////////////////////////////////////
+// Write the normalized weights, and report the effective sample
+// size, the conditional mean and standard deviation, before and
+// after resampling
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::Summarize(const SampleAccumulator& acc, const std::vector<Real>& w) const
+{
+  int NOS = w.size();
+  int num_params = acc.NumParams();
+
+  std::stringstream WeightStr;
+  WeightStr<<Name()<<"Weights.dat";
+  std::ofstream of1;
+  of1.open(WeightStr.str().c_str());
+  of1 << std::setprecision(20);
+  for(int ii=0; ii<NOS; ii++){
+    of1 << w[ii] << '\n';
+  }
+  of1.close();
 
-  // Compute conditional mean
-  std::vector<Real> CondMean(num_params);
-  WeightedMean(CondMean, w, samples);
+  // Approximate effective sample size and quality measure R
+  std::cout <<  " " << std::endl;
+  std::cout <<  "Effective sample size = "<< acc.EffSampleSize() << std::endl;
+  std::cout <<  "Quality measure R = "<< acc.CompR() << std::endl;
 
-  // Variance
-  std::vector<Real> CondVar(num_params);
-  WeightedVar(CondVar,CondMean, w, samples);
+  // Conditional mean and variance
+  const std::vector<Real>& CondMean = acc.Mean();
+  std::vector<Real> CondVar;
+  acc.Var(CondVar);
 
   // Print stuff to screen
   for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Prior mean = "<< prior_mean[jj] << std::endl;
-	  std::cout <<  "Conditional mean = "<< CondMean[jj] << std::endl;
-	  std::cout <<  "Standard deviation = "<< sqrt(CondVar[jj]) << std::endl;
+    std::cout <<  "Conditional mean = "<< CondMean[jj] << std::endl;
+    std::cout <<  "Standard deviation = "<< sqrt(CondVar[jj]) << std::endl;
   }
 
-  // Write samples and weights into files
-  WriteSamplesWeights(samples,w,"PriorMCSampler");
+  // Resampled samples
+  const SampleMatrix& Xrs = acc.Resampled();
+  if (Xrs.NumSamples() > 0) {
+    WriteResampledSamples(Xrs,Name());
 
-  // Resampling
-  std::vector<std::vector<Real> > Xrs(NOS, std::vector<Real>(num_params,-1));// resampled parameters
-  Resampling(Xrs,w,samples);
-  WriteResampledSamples(Xrs,"PriorMCSampler");
+    // Compute conditional mean after resampling
+    std::vector<Real> CondMeanRs(num_params);
+    Mean(CondMeanRs, Xrs);
 
-  // Compute conditional mean after resampling
-  std::vector<Real> CondMeanRs(num_params);
-  Mean(CondMeanRs, Xrs);
-  
-  // Variance after resampling
-  std::vector<Real> CondVarRs(num_params);
-  Var(CondVarRs, CondMeanRs, Xrs);
+    // Variance after resampling
+    std::vector<Real> CondVarRs(num_params);
+    Var(CondVarRs, CondMeanRs, Xrs);
 
-  // Print results of resampling
-  for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Conditional mean after resampling = "<< CondMeanRs[jj] << std::endl;
-	  std::cout <<  "Standard deviation after resampling = "<< sqrt(CondVarRs[jj]) << std::endl;
+    // Print results of resampling
+    for(int jj=0; jj<num_params; jj++){
+      std::cout <<  "Conditional mean after resampling = "<< CondMeanRs[jj] << std::endl;
+      std::cout <<  "Standard deviation after resampling = "<< sqrt(CondVarRs[jj]) << std::endl;
+    }
   }
 
   std::cout <<  " " << std::endl;
-  std::cout <<  "End sampling with prior" << std::endl;
+  std::cout <<  "End " << Name() << std::endl;
   std::cout <<  " " << std::endl;
 }
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
 
-LinearMapSampler::LinearMapSampler(const std::vector<Real>& mu_,
-                                   const MyMat& H_,
-                                   const MyMat& invsqrt_,
-                                   Real phi_)
-  : mu(mu_), H(H_), invsqrt(invsqrt_), phi(phi_)
+PriorMCSampler::PriorMCSampler(const std::vector<Real>& prior_mean_,
+                               const std::vector<Real>& prior_std_)
+  : prior_mean(prior_mean_), prior_std(prior_std_)
 {}
 
 void
-LinearMapSampler::Sample(void* p, std::vector<std::vector<Real> >& samples, std::vector<Real>& w) const
+PriorMCSampler::SampleChunk(void* p, int iBegin, SampleMatrix& chunk, std::vector<Real>& nlw) const
 {
   MINPACKstruct *str = (MINPACKstruct*)(p);
-  str->ResizeWork();
 	  
   int num_params = str->parameter_manager.NumParams();
-  int NOS = samples.size();
-
-  std::vector<Real> sample_data(str->expt_manager.NumExptData());
-  std::vector<Real> s(num_params);
-  std::vector<Real> Fo(NOS);
-  
-  std::cout <<  " " << std::endl;
-  std::cout <<  "Starting linear map sampler " << std::endl;
-  std::cout <<  "Number of samples: " << NOS << std::endl;
+  int nb = chunk.NumSamples();
+  const Real bad_sample = std::numeric_limits<Real>::infinity();
 
   const std::vector<Real>& upper_bound = str->parameter_manager.UpperBound();
   const std::vector<Real>& lower_bound = str->parameter_manager.LowerBound();
 
-  for(int ii=0; ii<NOS; ii++){
-    BL_ASSERT(samples[ii].size()==num_params);
-
+  // Each sample draws from its own random stream (or its own Sobol
+  // point, with redraws out of bounds from its retry stream), so the
+  // samples do not depend on the number of threads
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+  for(int ib=0; ib<nb; ib++){
+    int ii = iBegin + ib;
+    Real* x = chunk[ib];
+    RandStream rs(RandSeed(),ii,(qmc ? RAND_TAG_RETRY : RAND_TAG_PROPOSAL));
+    if (qmc) {
+      BL_ASSERT(qmc->Dim() == num_params);
+      qmc->Normal(ii,x);
+    }
+    else {
+      rs.FillNormal(x,num_params);
+    }
     for(int jj=0; jj<num_params; jj++){
-      samples[ii][jj] = mu[jj];
-      for(int kk=0; kk<num_params; kk++){
-        samples[ii][jj] += invsqrt[jj][kk]*randn();
-      }
-      
-      bool sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+      x[jj] = prior_mean[jj] + prior_std[jj]*x[jj];
+      bool sample_oob = (x[jj] < lower_bound[jj] || x[jj] > upper_bound[jj]);
 
       while (sample_oob) {
+#ifdef _OPENMP
+#pragma omp critical (sampler_log)
+#endif
         std::cout <<  "sample is out of bounds, parameter " << jj
-                  << " val,lb,ub: " << samples[ii][jj]
+                  << " val,lb,ub: " << x[jj]
                   << ", " << lower_bound[jj] << ", " << upper_bound[jj] << std::endl;
-
-        samples[ii][jj] = mu[jj];
-        for(int kk=0; kk<num_params; kk++){
-          samples[ii][jj] += invsqrt[jj][kk]*randn();
-        }
-        sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj]);
+        x[jj] = prior_mean[jj] + prior_std[jj]*rs.randn();
+        sample_oob = (x[jj] < lower_bound[jj] || x[jj] > upper_bound[jj]);
       }
-	
     }
-    Fo[ii] = F0(samples[ii],mu,H,phi);
   }
 
-
-#ifdef _OPENMP
-  int tnum = omp_get_max_threads();
-  BL_ASSERT(tnum>0);
-  std::cout <<  " number of threads: " << tnum << std::endl;
-#else
-  int tnum = 1;
-#endif
-  Real dthread = NOS / Real(tnum);
-  std::vector<int> trange(tnum);
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    trange[ithread] = ithread * dthread;
+  // The evaluations go one at a time, as they share the experiments
+  for(int ib=0; ib<nb; ib++){
+    std::vector<Real> s = chunk.Sample(ib);
+    std::vector<Real> sample_data(str->expt_manager.NumExptData());
+    bool ok = str->expt_manager.GenerateTestMeasurements(s,sample_data);
+    nlw[ib] = (ok ? str->expt_manager.ComputeLikelihood(sample_data) : bad_sample);
   }
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    int iBegin = trange[ithread];
-    int iEnd = (ithread==tnum-1 ? NOS : trange[ithread+1]);
-
-    for(int ii=iBegin; ii<iEnd; ii++){
-      str->expt_manager.GenerateTestMeasurements(samples[ii],sample_data);
-      Real F = NegativeLogLikelihood(samples[ii]);
-      w[ii] = -Fo[ii] + F;
-    }
-  }
-  Real wmin = w[0];
-  for(int ii=0; ii<NOS; ii++){
-    wmin = std::min(w[ii],wmin);
-  }
-  for(int ii=0; ii<NOS; ii++){
-    w[ii] = (w[ii] == -1 ? 0 : std::exp(-(w[ii] - wmin)));
-  }
-
-  // Normalize weights, print to terminal
-  NormalizeWeights(w);
-  
-  // Approximate effective sample size	
-  Real Neff = EffSampleSize(w,NOS);
-  std::cout <<  " " << std::endl;
-  std::cout <<  "Effective sample size = "<< Neff << std::endl;
-  Real R = CompR(w,NOS);
-  std::cout <<  "Quality measure R = "<< R << std::endl;
-
-  // Compute conditional mean
-  std::vector<Real> CondMean(num_params);
-  WeightedMean(CondMean, w, samples);
-
-  // Variance
-  std::vector<Real> CondVar(num_params);
-  WeightedVar(CondVar,CondMean, w, samples);
-
-  // Print stuff to screen
-  for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Conditional mean = "<< CondMean[jj] << std::endl;
-	  std::cout <<  "Standard deviation = "<< sqrt(CondVar[jj]) << std::endl;
-  }
+LinearMapSampler::LinearMapSampler(const std::vector<Real>& mu_,
+                                   const MyMat& H_,
+                                   const MyMat& invsqrt_,
+                                   Real phi_)
+  : mu(mu_), H(H_), invsqrt(invsqrt_), phi(phi_)
+{}
 
-  // Write samples and weights into files
-  WriteSamplesWeights(samples, w,"LinearMapSampler");
+void
+LinearMapSampler::SampleChunk(void* p, int iBegin, SampleMatrix& chunk, std::vector<Real>& nlw) const
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+	  
+  int nb = chunk.NumSamples();
+  const Real bad_sample = std::numeric_limits<Real>::infinity();
 
-  // Resampling
-  std::vector<std::vector<Real> > Xrs(NOS, std::vector<Real>(num_params,-1));// resampled parameters
-  Resampling(Xrs,w,samples);
-  WriteResampledSamples(Xrs,"LinearMapSampler");
+  const std::vector<Real>& upper_bound = str->parameter_manager.UpperBound();
+  const std::vector<Real>& lower_bound = str->parameter_manager.LowerBound();
 
-  // Compute conditional mean after resampling
-  std::vector<Real> CondMeanRs(num_params);
-  Mean(CondMeanRs, Xrs);
-  
-  // Variance after resampling
-  std::vector<Real> CondVarRs(num_params);
-  Var(CondVarRs, CondMeanRs, Xrs);
+  linear_map_proposals(mu,invsqrt,lower_bound,upper_bound,false,iBegin,qmc,chunk);
 
-  // Print results of resampling
-  for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Conditional mean after resampling = "<< CondMeanRs[jj] << std::endl;
-	  std::cout <<  "Standard deviation after resampling = "<< sqrt(CondVarRs[jj]) << std::endl;
+  // The evaluations go one at a time, as they share the experiments
+  for(int ib=0; ib<nb; ib++){
+    Real Fo = F0(chunk[ib],mu,H,phi);
+    std::vector<Real> x = chunk.Sample(ib);
+    Real F = NegativeLogLikelihood(x);
+    nlw[ib] = (F < 0 ? bad_sample : -Fo + F);
   }
-
-
-  std::cout <<  " " << std::endl;
-  std::cout <<  "End linear map sampler" << std::endl;
-  std::cout <<  " " << std::endl;
 }
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -301,151 +702,536 @@ LinearMapSampler::Sample(void* p, std::vector<std::vector<Real> >& samples, std:
 
 
 void
-SymmetrizedLinearMapSampler::Sample(void* p,std::vector<std::vector<Real> >& samples, std::vector<Real>& w) const
+SymmetrizedLinearMapSampler::SampleChunk(void* p, int iBegin, SampleMatrix& chunk, std::vector<Real>& nlw) const
 {
   MINPACKstruct *str = (MINPACKstruct*)(p);
-  str->ResizeWork();
 	  
   int num_params = str->parameter_manager.NumParams();
-  int NOS = samples.size();
-
-  std::vector<Real> sample_data(str->expt_manager.NumExptData());
-  std::vector<Real> s(num_params);
-  std::vector<Real> Fo(NOS);
-  std::vector<std::vector<Real> > negsamples(NOS, std::vector<Real>(num_params,-1));
-
-  
-  std::cout <<  " " << std::endl;
-  std::cout <<  "Starting symmetrized linear map sampler " << std::endl;
-  std::cout <<  "Number of samples: " << NOS << std::endl;
+  int nb = chunk.NumSamples();
+  const Real bad_sample = std::numeric_limits<Real>::infinity();
 
   const std::vector<Real>& upper_bound = str->parameter_manager.UpperBound();
   const std::vector<Real>& lower_bound = str->parameter_manager.LowerBound();
 
-  for(int ii=0; ii<NOS; ii++){
-    BL_ASSERT(samples[ii].size()==num_params);
+  linear_map_proposals(mu,invsqrt,lower_bound,upper_bound,true,iBegin,qmc,chunk);
 
+  // The evaluations go one at a time, as they share the experiments
+  for(int ib=0; ib<nb; ib++){
+    int ii = iBegin + ib;
+    Real Fo = F0(chunk[ib],mu,H,phi);
+    std::vector<Real> x = chunk.Sample(ib);
+    std::vector<Real> negx(num_params);
     for(int jj=0; jj<num_params; jj++){
-      samples[ii][jj] = mu[jj];
-      negsamples[ii][jj] = mu[jj];
-      for(int kk=0; kk<num_params; kk++){
-	Real tmp = randn();
-        samples[ii][jj]    += invsqrt[jj][kk]*tmp;
-	negsamples[ii][jj] -= invsqrt[jj][kk]*tmp;
-      }
-      
-      bool sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj] || negsamples[ii][jj] < lower_bound[jj] || negsamples[ii][jj] > upper_bound[jj]);
+      negx[jj] = 2*mu[jj] - x[jj];
+    }
+    Real F = NegativeLogLikelihood(x);
+    Real negF = NegativeLogLikelihood(negx);
+
+    // Weight of the pair, -Fo - log(exp(-F) + exp(-negF)), evaluated
+    // relative to the smaller of F and negF.  A failed evaluation
+    // contributes nothing, and the other member of the pair is kept.
+    bool pick_neg;
+    if (F < 0 && negF < 0) {
+      nlw[ib] = bad_sample;
+      pick_neg = false;
+    }
+    else if (F < 0 || negF < 0) {
+      nlw[ib] = -Fo + (F < 0 ? negF : F);
+      pick_neg = (F < 0);
+    }
+    else {
+      nlw[ib] = -Fo + std::min(F,negF) - std::log( 1+std::exp(-std::abs(F-negF)) );
+      // pick -x with probability w(x)/(w(x)+w(-x))
+      RandStream rs(RandSeed(),ii,RAND_TAG_ACCEPT);
+      Real tmp = rs.drand();
+      pick_neg = (tmp < 1 / (1+std::exp(F-negF)));
+    }
+    if (pick_neg) {
+      chunk.SetSample(ib,&(negx[0]));
+    }
+  }
+}
 
-      while (sample_oob) {
-        std::cout <<  "sample is out of bounds, parameter " << jj
-                  << " val,lb,ub: " << samples[ii][jj]
-                  << ", " << lower_bound[jj] << ", " << upper_bound[jj] << std::endl;
+RandomMapSampler::RandomMapSampler(const std::vector<Real>& mu_,
+                                   const MyMat& H_,
+                                   const MyMat& invsqrt_,
+                                   Real phi_,
+                                   Real tol_,
+                                   int max_iter_)
+  : LinearMapSampler(mu_,H_,invsqrt_,phi_), tol(tol_), max_iter(max_iter_)
+{}
 
-        samples[ii][jj] = mu[jj];
-        for(int kk=0; kk<num_params; kk++){
- 	  Real tmp = randn();
-          samples[ii][jj]    += invsqrt[jj][kk]*tmp;
-	  negsamples[ii][jj] -= invsqrt[jj][kk]*tmp;
-        }
-        sample_oob = (samples[ii][jj] < lower_bound[jj] || samples[ii][jj] > upper_bound[jj] || negsamples[ii][jj] < lower_bound[jj] || negsamples[ii][jj] > upper_bound[jj]);
+// /////////////////////////////////////////////////////////
+// Lockstep solve of the random map equations of a chunk.
+//
+// With h(lambda) = F(mu + lambda L xi) - phi, the first update
+// assumes h is quadratic in lambda (exact if F is), and later
+// updates are secant steps on g = h - rho/2.  Samples whose
+// likelihood fails, or that do not converge in max_iter
+// iterations, get zero weight.  The directional derivative in
+// the weight is a forward difference with relative step
+// param_eps, done as one more batch.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+RandomMapSampler::SampleChunk(void* p, int iBegin, SampleMatrix& chunk, std::vector<Real>& nlw) const
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+
+  int n = str->parameter_manager.NumParams();
+  int nb = chunk.NumSamples();
+  const Real bad_sample = std::numeric_limits<Real>::infinity();
+
+  // Directions d = L xi, and rho = xi^T xi
+  SampleMatrix d(nb,n);
+  std::vector<Real> rho(nb);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int ib=0; ib<nb; ++ib) {
+    std::vector<Real> xi(n);
+    proposal_normals(qmc,iBegin+ib,&(xi[0]),n);
+    rho[ib] = 0;
+    for (int j=0; j<n; ++j) {
+      Real Lxi = 0;
+      for (int k=0; k<n; ++k) {
+        Lxi += invsqrt[j][k] * xi[k];
       }
-	
+      d[ib][j] = Lxi;
+      rho[ib] += xi[j] * xi[j];
     }
-    Fo[ii] = F0(samples[ii],mu,H,phi);
   }
 
+  std::vector<Real> lambda(nb,1), lambda_old(nb,0), g_old(nb,0), F(nb,bad_sample);
+  std::vector<int> active, converged;
+  for (int ib=0; ib<nb; ++ib) {
+    active.push_back(ib);
+  }
 
-#ifdef _OPENMP
-  int tnum = omp_get_max_threads();
-  BL_ASSERT(tnum>0);
-  std::cout <<  " number of threads: " << tnum << std::endl;
-#else
-  int tnum = 1;
-#endif
-  Real dthread = NOS / Real(tnum);
-  std::vector<int> trange(tnum);
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    trange[ithread] = ithread * dthread;
+  SampleMatrix X;
+  std::vector<Real> logL;
+  for (int iter=0; iter<max_iter && active.size()>0; ++iter) {
+    int na = active.size();
+    X.resize(na,n);
+    logL.resize(na);
+    for (int ia=0; ia<na; ++ia) {
+      int ib = active[ia];
+      for (int j=0; j<n; ++j) {
+        X[ia][j] = mu[j] + lambda[ib] * d[ib][j];
+      }
+    }
+    Driver::LogLikelihoodBatch(X.dataPtr(),na,&(logL[0]));
+
+    std::vector<int> still_active;
+    for (int ia=0; ia<na; ++ia) {
+      int ib = active[ia];
+      Real Fi = -logL[ia];
+      if (Fi < 0) {
+        continue; // Failed, weight stays zero
+      }
+      Real h = Fi - phi;
+      Real g = h - 0.5*rho[ib];
+      if (std::abs(g) <= tol * (1 + 0.5*rho[ib])) {
+        F[ib] = Fi;
+        converged.push_back(ib);
+        continue;
+      }
+
+      Real lnew = -1;
+      if (iter > 0 && g != g_old[ib]) {
+        lnew = lambda[ib] - g * (lambda[ib] - lambda_old[ib]) / (g - g_old[ib]);
+      }
+      if (!(lnew > 0)) {
+        lnew = (h > 0 ? lambda[ib] * std::sqrt(0.5*rho[ib] / h) : 2*lambda[ib]);
+      }
+      lambda_old[ib] = lambda[ib];
+      g_old[ib] = g;
+      lambda[ib] = lnew;
+      still_active.push_back(ib);
+    }
+    active.swap(still_active);
   }
 
+  if (active.size() > 0) {
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp critical (sampler_log)
 #endif
-  for (int ithread = 0; ithread < tnum; ithread++) {
-    int iBegin = trange[ithread];
-    int iEnd = (ithread==tnum-1 ? NOS : trange[ithread+1]);
-
-    for(int ii=iBegin; ii<iEnd; ii++){
-      str->expt_manager.GenerateTestMeasurements(samples[ii],sample_data);
-      Real F = NegativeLogLikelihood(samples[ii]);
-      Real negF = NegativeLogLikelihood(negsamples[ii]);
-      w[ii] = -Fo[ii] + F - std::log( 1+std::exp(F-negF) );
-      // pick -x with probability w(x)/(w(x)+w(-x))
-      Real tmp = drand();
-      if(  tmp < 1 / (1+std::exp(F-negF))){
-         samples[ii] = negsamples[ii];	      
+    std::cout << active.size() << " random map equations did not converge in "
+              << max_iter << " iterations" << std::endl;
+  }
+
+  // Directional derivatives grad F . d at the solutions
+  int nc = converged.size();
+  X.resize(nc,n);
+  logL.resize(nc);
+  std::vector<Real> dl(nc);
+  for (int ic=0; ic<nc; ++ic) {
+    int ib = converged[ic];
+    dl[ic] = str->param_eps * lambda[ib];
+    for (int j=0; j<n; ++j) {
+      X[ic][j] = mu[j] + (lambda[ib] + dl[ic]) * d[ib][j];
+    }
+  }
+  if (nc > 0) {
+    Driver::LogLikelihoodBatch(X.dataPtr(),nc,&(logL[0]));
+  }
+
+  for (int ib=0; ib<nb; ++ib) {
+    nlw[ib] = bad_sample;
+    for (int j=0; j<n; ++j) {
+      chunk[ib][j] = mu[j] + lambda[ib] * d[ib][j];
+    }
+  }
+  for (int ic=0; ic<nc; ++ic) {
+    int ib = converged[ic];
+    Real Fp = -logL[ic];
+    Real dF = (Fp - F[ib]) / dl[ic];
+    if (Fp >= 0 && dF != 0) {
+      nlw[ib] = -( (n-1)*std::log(lambda[ib]) + std::log(rho[ib]) - std::log(std::abs(dF)) );
+    }
+  }
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+// /////////////////////////////////////////////////////////
+// Gaussian proposal N(mean, L L^T) of one round of the adaptive
+// sampler, with the inverse covariance and log det L to
+// evaluate its density
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+struct GaussianProposal
+{
+  std::vector<Real> mean;
+  MyMat L, Sinv;
+  Real logdetL;
+  int NOS;
+
+  // log density, up to -n/2 log(2 pi)
+  Real LogDensity(const Real* x) const {
+    return -Sampler::F0(x,mean,Sinv,0) - logdetL;
+  }
+};
+
+// Set L, Sinv and logdetL for the covariance Sigma, return false
+// if Sigma is not positive definite.  If q.L is already set (the
+// map of the first round), it is kept, and Sigma must be L L^T.
+static bool
+factor_proposal(const MyMat& Sigma, GaussianProposal& q)
+{
+  int n = Sigma.size();
+  std::vector<Real> a(n*n);
+  for (int i=0; i<n; ++i) {
+    for (int j=0; j<n; ++j) {
+      a[i*n+j] = Sigma[i][j];
+    }
+  }
+  lapack_int info = LAPACKE_dpotrf(LAPACK_ROW_MAJOR,'L',n,&(a[0]),n);
+  if (info != 0) {
+    return false;
+  }
+
+  bool have_map = (q.L.size() == n);
+  if (!have_map) {
+    q.L.assign(n,std::vector<Real>(n,0));
+  }
+  q.logdetL = 0;
+  for (int i=0; i<n; ++i) {
+    q.logdetL += std::log(a[i*n+i]);
+    if (!have_map) {
+      for (int j=0; j<=i; ++j) {
+        q.L[i][j] = a[i*n+j];
       }
     }
   }
-  Real wmin = w[0];
-  for(int ii=0; ii<NOS; ii++){
-    wmin = std::min(w[ii],wmin);
+
+  info = LAPACKE_dpotri(LAPACK_ROW_MAJOR,'L',n,&(a[0]),n);
+  if (info != 0) {
+    return false;
   }
-  for(int ii=0; ii<NOS; ii++){
-    w[ii] = (w[ii] == -1 ? 0 : std::exp(-(w[ii] - wmin)));
+  q.Sinv.assign(n,std::vector<Real>(n,0));
+  for (int i=0; i<n; ++i) {
+    for (int j=0; j<=i; ++j) {
+      q.Sinv[i][j] = q.Sinv[j][i] = a[i*n+j];
+    }
   }
+  return true;
+}
 
-  // Normalize weights, print to terminal
-  NormalizeWeights(w);
-  
-  // Approximate effective sample size	
-  Real Neff = EffSampleSize(w,NOS);
-  std::cout <<  " " << std::endl;
-  std::cout <<  "Effective sample size = "<< Neff << std::endl;
-  Real R = CompR(w,NOS);
-  std::cout <<  "Quality measure R = "<< R << std::endl;
+// Stores the samples of a round with their negative log target,
+// F = nlw + F0, recovered from the linear map weights
+struct AdaptiveChunkHandler
+  : public Sampler::ChunkHandler
+{
+  AdaptiveChunkHandler(const GaussianProposal& _q,
+                       SampleMatrix&           _X,
+                       std::vector<Real>&      _F)
+    : q(_q), X(_X), F(_F) {}
+
+  virtual void Add(int iBegin, const SampleMatrix& chunk, const std::vector<Real>& nlw)
+  {
+    for (int ib=0; ib<chunk.NumSamples(); ++ib) {
+      int ii = iBegin + ib;
+      X.SetSample(ii,chunk[ib]);
+      F[ii] = nlw[ib] + Sampler::F0(chunk[ib],q.mean,q.Sinv,0);
+    }
+    std::cout << " Completed " << iBegin + chunk.NumSamples() << " samples" << std::endl;
+  }
 
-  // Compute conditional mean
-  std::vector<Real> CondMean(num_params);
-  WeightedMean(CondMean, w, samples);
+  const GaussianProposal& q;
+  SampleMatrix& X;
+  std::vector<Real>& F;
+};
+
+// The sampler of one round: the linear map of the round's proposal,
+// but samples out of bounds are kept with weight zero rather than
+// redrawn.  Redrawing would sample each round's Gaussian truncated to
+// the bounds, whose normalization the mixture weights do not include.
+class AdaptiveRoundSampler
+  : public LinearMapSampler
+{
+public:
+  AdaptiveRoundSampler(const GaussianProposal& q)
+    : LinearMapSampler(q.mean,q.Sinv,q.L,0) {}
+
+  virtual void SampleChunk(void* p, int iBegin, SampleMatrix& chunk, std::vector<Real>& nlw) const
+  {
+    MINPACKstruct *str = (MINPACKstruct*)(p);
+    int nb = chunk.NumSamples();
+    const Real bad_sample = std::numeric_limits<Real>::infinity();
+
+    const std::vector<Real>& upper_bound = str->parameter_manager.UpperBound();
+    const std::vector<Real>& lower_bound = str->parameter_manager.LowerBound();
+
+    std::vector<int> oob(nb,0);
+    linear_map_proposals(mu,invsqrt,lower_bound,upper_bound,false,iBegin,qmc,chunk,&oob);
+
+    for(int ib=0; ib<nb; ib++){
+      if (oob[ib]) {
+        nlw[ib] = bad_sample;
+        continue;
+      }
+      Real Fo = F0(chunk[ib],mu,H,phi);
+      std::vector<Real> x = chunk.Sample(ib);
+      Real F = NegativeLogLikelihood(x);
+      nlw[ib] = (F < 0 ? bad_sample : -Fo + F);
+    }
+  }
 
-  // Variance
-  std::vector<Real> CondVar(num_params);
-  WeightedVar(CondVar,CondMean, w, samples);
+  virtual const char* Name() const {return "AdaptiveRoundSampler";}
+};
 
-  // Print stuff to screen
-  for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Conditional mean = "<< CondMean[jj] << std::endl;
-	  std::cout <<  "Standard deviation = "<< sqrt(CondVar[jj]) << std::endl;
+// Sigma = L L^T
+static void
+map_covariance(const MyMat& L, MyMat& Sigma)
+{
+  int n = L.size();
+  Sigma.assign(n,std::vector<Real>(n,0));
+  for (int i=0; i<n; ++i) {
+    for (int j=0; j<n; ++j) {
+      for (int k=0; k<n; ++k) {
+        Sigma[i][j] += L[i][k] * L[j][k];
+      }
+    }
   }
+}
 
-  // Write samples and weights into files
-  WriteSamplesWeights(samples, w,"SymmetrizedLinearMapSampler");
+// Deterministic-mixture negative log weights of the first NOS
+// samples, F + log sum_t (N_t/N) q_t(x)
+static void
+mixture_log_weights(const std::vector<GaussianProposal>& rounds,
+                    const SampleMatrix&                  X,
+                    const std::vector<Real>&             F,
+                    int                                  NOS,
+                    std::vector<Real>&                   nlw)
+{
+  const Real inf = std::numeric_limits<Real>::infinity();
+  int nrounds = rounds.size();
+  nlw.resize(NOS);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int ii=0; ii<NOS; ++ii) {
+    if (F[ii] == inf) {
+      nlw[ii] = inf;
+      continue;
+    }
+    std::vector<Real> lq(nrounds);
+    Real lqmax = -inf;
+    for (int t=0; t<nrounds; ++t) {
+      lq[t] = std::log(rounds[t].NOS / Real(NOS)) + rounds[t].LogDensity(X[ii]);
+      lqmax = std::max(lqmax,lq[t]);
+    }
+    Real sum = 0;
+    for (int t=0; t<nrounds; ++t) {
+      sum += std::exp(lq[t] - lqmax);
+    }
+    nlw[ii] = F[ii] + (lqmax + std::log(sum));
+  }
+}
 
-  // Resampling
-  std::vector<std::vector<Real> > Xrs(NOS, std::vector<Real>(num_params,-1));// resampled parameters
-  Resampling(Xrs,w,samples);
-  WriteResampledSamples(Xrs,"SymmetrizedLinearMapSampler");
+static void
+bcast_proposal(GaussianProposal& q, int n)
+{
+  int root = ParallelDescriptor::IOProcessorNumber();
+  q.mean.resize(n);
+  q.L.resize(n);
+  q.Sinv.resize(n);
+  ParallelDescriptor::Bcast(&(q.mean[0]), n, root);
+  for (int i=0; i<n; ++i) {
+    q.L[i].resize(n);
+    q.Sinv[i].resize(n);
+    ParallelDescriptor::Bcast(&(q.L[i][0]), n, root);
+    ParallelDescriptor::Bcast(&(q.Sinv[i][0]), n, root);
+  }
+  ParallelDescriptor::Bcast(&(q.logdetL), 1, root);
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
 
-  // Compute conditional mean after resampling
-  std::vector<Real> CondMeanRs(num_params);
-  Mean(CondMeanRs, Xrs);
-  
-  // Variance after resampling
-  std::vector<Real> CondVarRs(num_params);
-  Var(CondVarRs, CondMeanRs, Xrs);
+AdaptiveLinearMapSampler::AdaptiveLinearMapSampler(const std::vector<Real>& mu_,
+                                                   const MyMat& H_,
+                                                   const MyMat& invsqrt_,
+                                                   Real phi_,
+                                                   int round_size_,
+                                                   Real target_ess_,
+                                                   int max_rounds_,
+                                                   Real cov_scale_)
+  : LinearMapSampler(mu_,H_,invsqrt_,phi_),
+    round_size(round_size_), max_rounds(max_rounds_),
+    target_ess(target_ess_), cov_scale(cov_scale_)
+{}
 
-  // Print results of resampling
-  for(int jj=0; jj<num_params; jj++){
-	  std::cout <<  "Conditional mean after resampling = "<< CondMeanRs[jj] << std::endl;
-	  std::cout <<  "Standard deviation after resampling = "<< sqrt(CondVarRs[jj]) << std::endl;
+// /////////////////////////////////////////////////////////
+// Each round is evaluated like a linear map sampler with the
+// round's proposal as its map.  Refitting the proposal and the
+// mixture weights are done on the IO processor, and the new
+// proposal is broadcast to all ranks.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+AdaptiveLinearMapSampler::Sample(void* p, SampleAccumulator& acc, std::vector<Real>& w,
+                                 int chunk_size, SampleMatrix* samples) const
+{
+  MINPACKstruct *str = (MINPACKstruct*)(p);
+  int num_params = str->parameter_manager.NumParams();
+  int NOS = w.size();
+  BL_ASSERT(acc.NumParams() == num_params);
+  BL_ASSERT(round_size > 0);
+
+  bool ioproc = ParallelDescriptor::IOProcessor();
+  if (ioproc) {
+    PrintHeader(NOS);
+    std::cout <<  " samples per round: " << round_size << std::endl;
+    std::cout <<  " target effective sample size: " << target_ess << std::endl;
+  }
+
+  // First round: the linear map, with Sigma = invsqrt invsqrt^T.
+  // Sigma is singular if InvSqrt dropped directions of H; those then
+  // get the variance of InvSqrt's eigenvalue cutoff.
+  GaussianProposal q;
+  q.mean = mu;
+  q.L = invsqrt;
+  MyMat Sigma;
+  map_covariance(q.L,Sigma);
+  if (!factor_proposal(Sigma,q)) {
+    if (ioproc) {
+      std::cout << "Linear map covariance singular, regularizing the dropped directions" << std::endl;
+    }
+    q.L = Minimizer::InvSqrt(p,H,true);
+    map_covariance(q.L,Sigma);
+    if (!factor_proposal(Sigma,q)) {
+      BoxLib::Abort("AdaptiveLinearMapSampler: initial proposal covariance not positive definite");
+    }
   }
 
+  std::vector<GaussianProposal> rounds;
+  SampleMatrix X;
+  std::vector<Real> F, nlw;
+  int nsamples = 0;
+  bool done = false;
 
-  std::cout <<  " " << std::endl;
-  std::cout <<  "End linear map sampler" << std::endl;
-  std::cout <<  " " << std::endl;
+  while (!done) {
+    int nr = std::min(round_size, NOS - nsamples);
+    q.NOS = nr;
+    rounds.push_back(q);
+
+    if (ioproc) {
+      X.resize(nsamples+nr,num_params);
+      F.resize(nsamples+nr);
+    }
+    AdaptiveRoundSampler round_sampler(q);
+    AdaptiveChunkHandler handler(rounds.back(),X,F);
+    round_sampler.EvaluateChunks(p,nsamples,nr,chunk_size,handler);
+    nsamples += nr;
+
+    int stop = 0;
+    if (ioproc) {
+      mixture_log_weights(rounds,X,F,nsamples,nlw);
+      std::vector<Real> wr(nlw);
+      NormalizeLogWeights(wr);
+      Real Neff = EffSampleSize(wr,nsamples);
+      std::cout << "Round " << rounds.size() << ": " << nsamples
+                << " samples, effective sample size = " << Neff << std::endl;
+
+      stop = (nsamples >= NOS || (int)rounds.size() >= max_rounds
+              || (target_ess > 0 && Neff >= target_ess));
+
+      if (!stop) {
+        // Refit the proposal to the weighted samples so far
+        GaussianProposal qnew;
+        WeightedMean(qnew.mean,wr,X);
+        WeightedCov(Sigma,qnew.mean,wr,X);
+        for (int i=0; i<num_params; ++i) {
+          for (int j=0; j<num_params; ++j) {
+            Sigma[i][j] *= cov_scale;
+          }
+        }
+        if (factor_proposal(Sigma,qnew)) {
+          q = qnew;
+        }
+        else {
+          std::cout << "Refitted covariance not positive definite, keeping proposal" << std::endl;
+        }
+      }
+    }
+    ParallelDescriptor::Bcast(&stop, 1, ParallelDescriptor::IOProcessorNumber());
+    done = stop;
+    if (!done) {
+      bcast_proposal(q,num_params);
+    }
+  }
+
+  w.resize(nsamples);
+  if (ioproc) {
+    std::stringstream SampleStr;
+    SampleStr<<Name()<<"Samples.dat";
+    std::ofstream of;
+    of.open(SampleStr.str().c_str());
+    of << std::setprecision(20);
+    for (int ii=0; ii<nsamples; ++ii) {
+      acc.Add(X[ii],nlw[ii],ii);
+      for (int jj=0; jj<num_params; jj++) {
+        of << X[ii][jj] << " ";
+      }
+      of << '\n';
+    }
+    of.close();
+    if (samples != 0) {
+      *samples = X;
+    }
+
+    w = nlw;
+    NormalizeLogWeights(w);
+    Summarize(acc,w);
+  }
+  ParallelDescriptor::Bcast(&(w[0]), nsamples, ParallelDescriptor::IOProcessorNumber());
 }
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
 
 // /////////////////////////////////////////////////////////
 // Normalize weights to that their sum is 1
@@ -456,12 +1242,57 @@ void
 Sampler::NormalizeWeights(std::vector<Real>& w)
 {
   int NOS = w.size();
-  Real SumWeights = 0;
+  Real SumWeights = ordered_sum(&(w[0]),NOS,false);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(int ii=0; ii<NOS; ii++){
-	SumWeights = SumWeights+w[ii];
+	w[ii] = w[ii]/SumWeights;
   }
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+
+// /////////////////////////////////////////////////////////
+// Turn negative log weights into normalized weights.  Failed
+// samples carry an infinite negative log weight and end up
+// with weight zero.  The normalization constant is computed as
+// a log-sum-exp shifted by the smallest negative log weight, so
+// that no exponential over- or underflows for all samples.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::NormalizeLogWeights(std::vector<Real>& w)
+{
+  int NOS = w.size();
+  const Real inf = std::numeric_limits<Real>::infinity();
+  Real wmin = inf;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(min:wmin)
+#endif
   for(int ii=0; ii<NOS; ii++){
-	w[ii] = w[ii]/SumWeights;
+    wmin = std::min(w[ii],wmin);
+  }
+  if (wmin == inf) {
+    BoxLib::Abort("Sampler::NormalizeLogWeights: all samples failed");
+  }
+
+  std::vector<Real> e(NOS);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for(int ii=0; ii<NOS; ii++){
+    e[ii] = (w[ii] == inf ? 0 : std::exp(-(w[ii] - wmin)));
+  }
+  Real logZ = -wmin + std::log(ordered_sum(&(e[0]),NOS,false));
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for(int ii=0; ii<NOS; ii++){
+    w[ii] = (w[ii] == inf ? 0 : std::exp(-w[ii] - logZ));
   }
 }
 // /////////////////////////////////////////////////////////
@@ -474,14 +1305,10 @@ Sampler::NormalizeWeights(std::vector<Real>& w)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::ScalarMean(Real& Mean, std::vector<Real> & samples)
+Sampler::ScalarMean(Real& Mean, const std::vector<Real> & samples)
 {
   int NOS = samples.size();
-  Mean = 0; // initialize  
-  for(int jj=0; jj<NOS; jj++){
-	  Mean = Mean+samples[jj];
-  }	  
-  Mean = Mean/NOS;	
+  Mean = ordered_sum(&(samples[0]),NOS,false)/NOS;
 }
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -493,17 +1320,10 @@ Sampler::ScalarMean(Real& Mean, std::vector<Real> & samples)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::Mean(std::vector<Real>& Mean, std::vector<std::vector<Real> >& samples)
+Sampler::Mean(std::vector<Real>& Mean, const SampleMatrix& samples)
 {
-  int NOS = samples.size();
-  int num_params = samples[1].size();
-  for(int ii=0; ii<num_params; ii++){
-	  Mean[ii] = 0; // initialize  
-	  for(int jj=0; jj<NOS; jj++){
-		  Mean[ii] = Mean[ii]+samples[jj][ii];
-	  }
-	  Mean[ii] = Mean[ii]/NOS;
-  }	
+  int NOS = samples.NumSamples();
+  weighted_sum(Mean,0,1/Real(NOS),samples);
 }
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -517,16 +1337,10 @@ Sampler::Mean(std::vector<Real>& Mean, std::vector<std::vector<Real> >& samples)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::WeightedMean(std::vector<Real>& CondMean, std::vector<Real>& w, std::vector<std::vector<Real> >& samples)
+Sampler::WeightedMean(std::vector<Real>& CondMean, const std::vector<Real>& w, const SampleMatrix& samples)
 {
-  int NOS = samples.size();
-  int num_params = samples[1].size();
-  for(int ii=0; ii<num_params; ii++){
-	  CondMean[ii] = 0; // initialize  
-	  for(int jj=0; jj<NOS; jj++){
-		  CondMean[ii] = CondMean[ii]+w[jj]*samples[jj][ii];
-	  }
-  }	
+  BL_ASSERT(w.size() == samples.NumSamples());
+  weighted_sum(CondMean,&(w[0]),0,samples);
 }
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -536,21 +1350,14 @@ Sampler::WeightedMean(std::vector<Real>& CondMean, std::vector<Real>& w, std::ve
 
 
 // /////////////////////////////////////////////////////////
-// Compute the covariance matrix from samples
+// Compute the variance from samples
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::Var(std::vector<Real>& Var,std::vector<Real>& Mean, std::vector<std::vector<Real> >& samples)
+Sampler::Var(std::vector<Real>& Var, const std::vector<Real>& Mean, const SampleMatrix& samples)
 {
-  int NOS = samples.size();
-  int num_params = samples[1].size();
-  for(int ii=0; ii<num_params; ii++){	  
-  Var[ii] = 0;
-  for(int jj=0; jj<NOS; jj++){
-	  Var[ii] = Var[ii] + (samples[jj][ii]-Mean[ii])*(samples[jj][ii]-Mean[ii]);
-  }
-  Var[ii] = Var[ii]/NOS;
-  }
+  int NOS = samples.NumSamples();
+  weighted_sum_squares(Var,Mean,0,1/Real(NOS),samples);
 }
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
@@ -558,19 +1365,74 @@ Sampler::Var(std::vector<Real>& Var,std::vector<Real>& Mean, std::vector<std::ve
 
 
 // /////////////////////////////////////////////////////////
-// Compute covariance from weighted samples
+// Compute variance from weighted samples
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::WeightedVar(std::vector<Real>& CondVar,std::vector<Real>& CondMean, std::vector<Real>& w, std::vector<std::vector<Real> >& samples)
+Sampler::WeightedVar(std::vector<Real>& CondVar, const std::vector<Real>& CondMean, const std::vector<Real>& w, const SampleMatrix& samples)
 {
-  int NOS = samples.size();
-  int num_params = samples[1].size();	
-  for(int ii=0; ii<num_params; ii++){	  
-  CondVar[ii] = 0;
-  for(int jj=0; jj<NOS; jj++){
-	  CondVar[ii] = CondVar[ii] + w[jj]*(samples[jj][ii]-CondMean[ii])*(samples[jj][ii]-CondMean[ii]);
+  BL_ASSERT(w.size() == samples.NumSamples());
+  weighted_sum_squares(CondVar,CondMean,&(w[0]),0,samples);
+}
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+
+
+// /////////////////////////////////////////////////////////
+// Compute covariance matrix from weighted samples.  Each block
+// accumulates the upper triangle of sum w (x-m)(x-m)^T, one
+// contiguous row at a time.
+// /////////////////////////////////////////////////////////
+// /////////////////////////////////////////////////////////
+void
+Sampler::WeightedCov(MyMat& CondCov, const std::vector<Real>& CondMean, const std::vector<Real>& w, const SampleMatrix& samples)
+{
+  int NOS = samples.NumSamples();
+  int n = samples.NumParams();
+  int nblocks = num_reduction_blocks(NOS);
+  BL_ASSERT(CondMean.size() == n);
+  BL_ASSERT(w.size() == NOS);
+
+  std::vector<Real> partial((size_t)nblocks*n*n,0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    Real* sum = &(partial[(size_t)iblock*n*n]);
+    std::vector<Real> d(n);
+    int iEnd = std::min(NOS,(iblock+1)*reduction_block_size);
+    for (int ii=iblock*reduction_block_size; ii<iEnd; ++ii) {
+      const Real* x = samples[ii];
+      for (int jj=0; jj<n; ++jj) {
+        d[jj] = x[jj] - CondMean[jj];
+      }
+      for (int jj=0; jj<n; ++jj) {
+        Real wd = w[ii]*d[jj];
+        Real* row = sum + jj*n;
+        for (int kk=jj; kk<n; ++kk) {
+          row[kk] += wd*d[kk];
+        }
+      }
+    }
   }
+
+  CondCov.resize(n);
+  for (int jj=0; jj<n; ++jj) {
+    CondCov[jj].assign(n,0);
+  }
+  for (int iblock=0; iblock<nblocks; ++iblock) {
+    const Real* sum = &(partial[(size_t)iblock*n*n]);
+    for (int jj=0; jj<n; ++jj) {
+      for (int kk=jj; kk<n; ++kk) {
+        CondCov[jj][kk] += sum[jj*n+kk];
+      }
+    }
+  }
+  for (int jj=0; jj<n; ++jj) {
+    for (int kk=0; kk<jj; ++kk) {
+      CondCov[jj][kk] = CondCov[kk][jj];
+    }
   }
 }
 // /////////////////////////////////////////////////////////
@@ -585,17 +1447,11 @@ Sampler::WeightedVar(std::vector<Real>& CondVar,std::vector<Real>& CondMean, std
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 Real
-Sampler::CompR(std::vector<Real>& w, int NOS)
-{
-   std::vector<Real> w2(NOS);
-   for(int ii=0; ii<NOS; ii++){
-	   w2[ii] = w[ii]*w[ii];
-   }
-   Real MeanW2;
-   ScalarMean(MeanW2, w2);
+Sampler::CompR(const std::vector<Real>& w, int NOS)
+{
+   Real MeanW2 = ordered_sum(&(w[0]),NOS,true)/NOS;
    std::cout << "Mean w^2 = "<< MeanW2 << std::endl;
-   Real MeanW;
-   ScalarMean(MeanW, w);
+   Real MeanW = ordered_sum(&(w[0]),NOS,false)/NOS;
    std::cout << "Mean w = "<< MeanW << std::endl;
    Real R = MeanW2/(MeanW*MeanW);
    return R;
@@ -613,13 +1469,10 @@ Sampler::CompR(std::vector<Real>& w, int NOS)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 Real
-Sampler::EffSampleSize(std::vector<Real>& w, int NOS)
+Sampler::EffSampleSize(const std::vector<Real>& w, int NOS)
 {
    // Approximate effective sample size
-   Real SumSquaredWeights = 0;
-   for(int ii=0; ii<NOS; ii++){
-	   SumSquaredWeights = SumSquaredWeights + w[ii]*w[ii];
-   }
+   Real SumSquaredWeights = ordered_sum(&(w[0]),NOS,true);
    Real Neff = 1/SumSquaredWeights; 
    return Neff;
 }
@@ -637,14 +1490,14 @@ Sampler::EffSampleSize(std::vector<Real>& w, int NOS)
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::WriteSamplesWeights(std::vector<std::vector<Real> >& samples, std::vector<Real>& w, const char *tag)
+Sampler::WriteSamplesWeights(const SampleMatrix& samples, const std::vector<Real>& w, const char *tag)
 {
   std::stringstream SampleStr;
   SampleStr<<tag<<"Samples.dat";
   std::stringstream WeightStr;
   WeightStr<<tag<<"Weights.dat";
-  int NOS = samples.size();
-  int num_params = samples[1].size();
+  int NOS = samples.NumSamples();
+  int num_params = samples.NumParams();
   std::ofstream of,of1;
   of.open(SampleStr.str().c_str());
   of1.open(WeightStr.str().c_str());
@@ -671,34 +1524,34 @@ Sampler::WriteSamplesWeights(std::vector<std::vector<Real> >& samples, std::vect
 
 
 // /////////////////////////////////////////////////////////
-// Resampling
+// Resampling (systematic).  Resampled sample jj is the sample
+// whose cdf interval contains u1 + jj/NOS, found by bisection
+// so that all samples can be resampled independently.
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::Resampling(std::vector<std::vector<Real> >& Xrs,std::vector<Real>& w,std::vector<std::vector<Real> >& samples)
+Sampler::Resampling(SampleMatrix& Xrs, const std::vector<Real>& w, const SampleMatrix& samples)
 {
-  int NOS = samples.size();
-  int num_params = samples[1].size();
+  int NOS = samples.NumSamples();
+  int num_params = samples.NumParams();
+  Xrs.resize(NOS,num_params);
   std::vector<Real> c(NOS+1);
-  for(int jj = 0;jj < NOS+1; jj++){
-	 c[jj] = 0; // initialize	  
-  }
   // construct cdf
+  c[0] = 0;
   for(int jj=1;jj<NOS+1;jj++){
 	  c[jj]=c[jj-1]+w[jj-1];
   }
   // sample it and get the stronger particles more often
-  int ii = 0; // initialize
-  Real u1 = drand()/NOS;
-  Real u = 0;
+  RandStream rs(RandSeed(),0,RAND_TAG_RESAMPLE);
+  Real u1 = rs.drand()/NOS;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(int jj=0;jj<NOS;jj++){
-    u = u1+(Real)jj/NOS;
-    while(u>c[ii]){
-        ii++;
-    }
-    for(int kk=0;kk<num_params;kk++){
-	    Xrs[jj][kk] = samples[(ii-1)][kk];
-    }
+    Real u = u1+(Real)jj/NOS;
+    int ii = std::lower_bound(c.begin(),c.end(),u) - c.begin();
+    ii = std::max(1,std::min(ii,NOS));
+    Xrs.SetSample(jj,samples[ii-1]);
   }
 }
 // /////////////////////////////////////////////////////////
@@ -714,12 +1567,12 @@ Sampler::Resampling(std::vector<std::vector<Real> >& Xrs,std::vector<Real>& w,st
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 void
-Sampler::WriteResampledSamples(std::vector<std::vector<Real> >& Xrs, const char *tag)
+Sampler::WriteResampledSamples(const SampleMatrix& Xrs, const char *tag)
 {
   std::stringstream SampleStr;
   SampleStr<<tag<<"ResampledSamples.dat";
-  int NOS = Xrs.size();
-  int num_params = Xrs[1].size();
+  int NOS = Xrs.NumSamples();
+  int num_params = Xrs.NumParams();
   std::ofstream of2;
   of2.open(SampleStr.str().c_str());
   of2 << std::setprecision(20);
@@ -743,16 +1596,14 @@ Sampler::WriteResampledSamples(std::vector<std::vector<Real> >& Xrs, const char
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 Real
-Sampler::F0(const std::vector<Real>& sample,
+Sampler::F0(const Real* sample,
             const std::vector<Real>& mu,
             const MyMat& H,
             Real phi)
 {
-  int N = sample.size();
+  int N = mu.size();
   Real F0 = 0;
 
-  BL_ASSERT(mu.size() == N);
-
   BL_ASSERT(H.size() == N);
   for(int i=0; i<N; i++){
     BL_ASSERT(H[i].size() == N);
@@ -772,4 +1623,3 @@ Sampler::F0(const std::vector<Real>& sample,
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
 // /////////////////////////////////////////////////////////
-
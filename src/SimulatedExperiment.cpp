@@ -2,6 +2,7 @@
 #include <iostream>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 
 #include <SimulatedExperiment.H>
 #include <ParmParse.H>
@@ -10,6 +11,7 @@
 #include <sys/time.h>
 
 #include <ParallelDescriptor.H>
+#include <Tracer.H>
 
 #ifdef _OPENMP
 #include "omp.h"
@@ -121,6 +123,16 @@ SimulatedExperiment::SimulatedExperiment()
 
 SimulatedExperiment::~SimulatedExperiment() {}
 
+SolverCounters&
+SolverCounters::operator+=(const SolverCounters& rhs)
+{
+  ode_intervals += rhs.ode_intervals;
+  rhs_evals += rhs.rhs_evals;
+  premix_solves += rhs.premix_solves;
+  premix_steps += rhs.premix_steps;
+  return *this;
+}
+
 void SimulatedExperiment::CopyData(int src, int dest, int tag){}
 
 void SimulatedExperiment::SetDiagnosticFilePrefix(const std::string& prefix)
@@ -411,6 +423,22 @@ ZeroDReactor::GetMeasurements(std::vector<Real>& simulated_observations,int data
 
   bool inside_range_leen = false;
   bool outside_range_leen = false;
+
+  bool sample_evolution = diagnostic_name != "pressure_rise"
+    && diagnostic_name != "max_pressure" 
+    && diagnostic_name != "max_OH" 
+    && diagnostic_name != "thresh_O" 
+    && diagnostic_name != "inflect_OH" 
+    && diagnostic_name != "onset_OH" 
+    && diagnostic_name != "onset_CO2" 
+    && diagnostic_name != "onset_pressure_rise"
+    && diagnostic_name != "mean_difference";
+
+  // Single-value diagnostics are located on the output times, so a
+  // cheaper fidelity level searches fewer of them
+  if (!sample_evolution && fidelity.time_points_factor != 1) {
+    data_num_points = std::max(2, int(data_num_points * fidelity.time_points_factor));
+  }
 	
   measurement_times.resize(data_num_points);
   Real dt = data_tend - data_tstart;  BL_ASSERT(dt>=0);
@@ -454,16 +482,6 @@ ZeroDReactor::GetMeasurements(std::vector<Real>& simulated_observations,int data
 
   int num_time_nodes = measurement_times.size();
   simulated_observations.resize(NumMeasuredValues());
- 
-  bool sample_evolution = diagnostic_name != "pressure_rise"
-    && diagnostic_name != "max_pressure" 
-    && diagnostic_name != "max_OH" 
-    && diagnostic_name != "thresh_O" 
-    && diagnostic_name != "inflect_OH" 
-    && diagnostic_name != "onset_OH" 
-    && diagnostic_name != "onset_CO2" 
-    && diagnostic_name != "onset_pressure_rise"
-    && diagnostic_name != "mean_difference";
 
   std::ofstream ofs;
   std::ofstream sfs;
@@ -551,6 +569,8 @@ ZeroDReactor::GetMeasurements(std::vector<Real>& simulated_observations,int data
       bool ok = cd.solveTransient_sdc(rYnew,rHnew,Tnew,rYold,rHold,Told,C_0,
 				      funcCnt,box,sCompY,sCompRH,sCompT,
 				      dt,Patm,diag,true);
+      counters.ode_intervals++;
+      counters.rhs_evals += (long) funcCnt.sum(0);
 
       if (!ok) {
 	return std::pair<bool,int>(false,ErrorID("VODE_FAILED"));
@@ -692,6 +712,8 @@ ZeroDReactor::GetMeasurements(std::vector<Real>& simulated_observations,int data
       Real dt = t_end - t_start;
       bool ok = cd.solveTransient(Ynew,Tnew,Yold,Told,funcCnt,box,
 				  sCompY,sCompT,dt,Patm);		
+      counters.ode_intervals++;
+      counters.rhs_evals += (long) funcCnt.sum(0);
 	
       if (!ok) {
 	return std::pair<bool,int>(false,ErrorID("VODE_FAILED"));
@@ -1099,6 +1121,7 @@ PREMIXReactor::PREMIXReactor(ChemDriver& _cd, const std::string& pp_prefix)
   premix_sol = new PremixSol(nComp,num_sol_pts);
   baseline_premix_sol = new PremixSol(nComp,num_sol_pts);
   have_baseline_sol = false;
+  warm_start = true;
   lrstrtflag=0;
 
   if (pp.countval("baseline_soln_file")) {
@@ -1250,6 +1273,46 @@ PREMIXReactor::SaveBaselineSolution(const std::string& prefix)
     }
 }
 
+bool
+PREMIXReactor::WriteBaselineSolution(const std::string& dir) const
+{
+  return (!have_baseline_sol || baseline_premix_sol->WriteSoln(dir));
+}
+
+bool
+PREMIXReactor::ReadBaselineSolution(const std::string& dir)
+{
+  have_baseline_sol = ReadBaselineSoln(dir);
+  return have_baseline_sol;
+}
+
+void
+PREMIXReactor::BcastBaselineSolution(int root)
+{
+  int have = have_baseline_sol;
+  ParallelDescriptor::Bcast(&have, 1, root);
+  have_baseline_sol = have;
+  if (have_baseline_sol) {
+    PremixSol* sol = baseline_premix_sol;
+    ParallelDescriptor::Bcast(&(sol->ngp), 1, root);
+    ParallelDescriptor::Bcast(sol->solvec, sol->ncomp*sol->maxgp + sol->nextra, root);
+  }
+}
+
+void
+PREMIXReactor::GetInputs(std::vector<std::string>& prefixes,
+                         std::vector<std::string>& files) const
+{
+  files.push_back(premix_input_path + premix_input_file);
+  if (lmc_soln_file != "") {
+    files.push_back(lmc_soln_file);
+  }
+  for (int i=0; i<prereq_reactors.size(); ++i) {
+    prefixes.push_back(prereq_reactors[i]->name);
+    prereq_reactors[i]->GetInputs(prefixes,files);
+  }
+}
+
 std::pair<bool,int>
 PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int data_num_points, Real data_tstart, Real data_tend)
 {
@@ -1261,6 +1324,10 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
   int lregrid;
   int lrstrt = 0;
   int v = Verbosity();
+  int max_iters = max_premix_iters;
+  if (fidelity.max_solver_iters > 0) {
+    max_iters = std::min(max_iters, fidelity.max_solver_iters);
+  }
 
 #ifndef PREMIX_RESTART
   /*
@@ -1271,12 +1338,12 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
    */
   lrstrtflag = 0; 
 #endif
-  if(have_baseline_sol)
+  if(have_baseline_sol && warm_start)
   {
       solCopyIn(baseline_premix_sol);
       lrstrtflag = 1; 
       //std::cerr << "Have baseline solution, " <<  baseline_premix_sol->ngp <<"/" << (premix_sol->ngp) << " gridpoints\n";
-  } else
+  } else if (!have_baseline_sol)
   {
     std::cerr << "No baseline solution for " << name << std::endl;
 // BoxLib::Abort();
@@ -1306,12 +1373,15 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
 	}
 
 	std::vector<Real> pr_obs;
+	TraceScope trace((*pr)->name,"prereq");
 	if (v > 0 && ParallelDescriptor::IOProcessor()) {
 	  std::cerr << " Running " << (*pr)->premix_input_file
 		    << " with restart = " << (*pr)->lrstrtflag << std::endl;
 	}
 
 	std::pair<bool,int> retVal = (*pr)->GetMeasurements(pr_obs, data_num_points, data_tstart, data_tend);
+	counters += (*pr)->Counters();
+	(*pr)->ClearCounters();
 	if (!retVal.first) {
 	  return std::pair<bool,int>(false,ErrorID("PREREQ_FAILED"));
 	}
@@ -1366,6 +1436,16 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
     }
   }
 
+  // Cheaper fidelity levels restart from the baseline solution on a
+  // coarser grid
+  if (have_baseline_sol && warm_start && fidelity.regrid_points > 0 && fidelity.regrid_points < *solsz) {
+    lregrid = fidelity.regrid_points;
+    if (v > 0 && ParallelDescriptor::IOProcessor()) {
+      std::cerr << " Regridding baseline solution to " << lregrid
+                << " from " << *solsz << " points" << std::endl;
+    }
+  }
+
   BL_ASSERT(savesol != NULL );
   BL_ASSERT(solsz != NULL );
 
@@ -1410,7 +1490,9 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
   int num_steps = 0;
   premix_(&nmax, &lin, &lout, &linmc, &lrin, &lrout, &lrcvr,
           &lenlwk, &leniwk, &lenrwk, &lencwk, 
-          savesol, solsz, &lrstrtflag, &lregrid, &is_good, &max_premix_iters, &num_steps);
+          savesol, solsz, &lrstrtflag, &lregrid, &is_good, &max_iters, &num_steps);
+  counters.premix_solves++;
+  counters.premix_steps += num_steps;
   
   // Extract the measurements
   // TODO: put into an 'ExtractMeasurements' for consistency with ZeroDReactor
@@ -1446,7 +1528,7 @@ PREMIXReactor::GetMeasurements(std::vector<Real>& simulated_observations,int dat
     simulated_observations[0]  = -1;
     lrstrtflag = 0;
     close_premix_files_( &lin, &linck, &lrin, &lrout, &lrcvr );
-    if (num_steps == max_premix_iters) {
+    if (num_steps == max_iters) {
       return std::pair<bool,int>(false,ErrorID("PREMIX_TOO_MANY_ITERS"));
     }
     return std::pair<bool,int>(false,ErrorID("PREMIX_SOLVER_FAILED"));
@@ -0,0 +1,226 @@
+#include <Sobol.H>
+#include <Rand.H>
+#include <Utility.H>
+#include <cmath>
+#include <algorithm>
+
+// ******************************************************
+// Primitive polynomials and initial direction numbers of
+// dimensions 2, 3, ... (Joe and Kuo, new-joe-kuo-6.21201).
+// s is the degree of the polynomial, a encodes its inner
+// coefficients, and m holds the s initial direction numbers.
+// Dimension 1 is the van der Corput sequence.
+// ******************************************************
+struct SobolInit
+{
+  int s, a;
+  uint32_t m[7];
+};
+
+static const SobolInit sobol_init[] = {
+  {1,  0, {1}},
+  {2,  1, {1, 3}},
+  {3,  1, {1, 3, 1}},
+  {3,  2, {1, 1, 1}},
+  {4,  1, {1, 1, 3, 3}},
+  {4,  4, {1, 3, 5, 13}},
+  {5,  2, {1, 1, 5, 5, 17}},
+  {5,  4, {1, 1, 5, 5, 5}},
+  {5,  7, {1, 1, 7, 11, 19}},
+  {5, 11, {1, 1, 5, 1, 1}},
+  {5, 13, {1, 1, 1, 3, 11}},
+  {5, 14, {1, 3, 5, 5, 31}},
+  {6,  1, {1, 3, 3, 9, 7, 49}},
+  {6, 13, {1, 1, 1, 15, 21, 21}},
+  {6, 16, {1, 3, 1, 13, 27, 49}},
+  {6, 19, {1, 1, 1, 15, 7, 5}},
+  {6, 22, {1, 3, 1, 15, 13, 25}},
+  {6, 25, {1, 1, 5, 5, 19, 61}},
+  {7,  1, {1, 3, 7, 11, 23, 15, 103}},
+  {7,  4, {1, 3, 7, 13, 13, 15, 69}},
+  {7,  7, {1, 1, 3, 13, 7, 35, 63}},
+  {7,  8, {1, 3, 5, 9, 1, 25, 53}},
+  {7, 14, {1, 3, 1, 13, 9, 35, 107}},
+  {7, 19, {1, 3, 1, 5, 27, 61, 31}},
+  {7, 21, {1, 1, 5, 11, 19, 41, 61}},
+  {7, 28, {1, 3, 5, 3, 3, 13, 69}},
+  {7, 31, {1, 1, 7, 13, 1, 19, 1}},
+  {7, 32, {1, 3, 7, 5, 13, 19, 59}},
+  {7, 37, {1, 1, 3, 9, 25, 29, 41}},
+  {7, 41, {1, 3, 5, 13, 23, 1, 55}},
+  {7, 42, {1, 3, 7, 3, 13, 59, 17}},
+  {7, 50, {1, 3, 1, 3, 5, 53, 69}},
+  {7, 55, {1, 1, 5, 5, 23, 33, 13}},
+  {7, 56, {1, 1, 7, 7, 1, 61, 123}},
+  {7, 59, {1, 1, 7, 9, 13, 61, 49}},
+  {7, 62, {1, 3, 3, 5, 3, 55, 33}}
+};
+
+static const int sobol_bits = 32;
+
+int
+ScrambledSobol::MaxDim()
+{
+  return 1 + sizeof(sobol_init) / sizeof(SobolInit);
+}
+
+// Direction numbers of dimension j, left-aligned in 32 bits
+static void
+direction_numbers(int j, uint32_t* v)
+{
+  if (j == 0) {
+    for (int k=0; k<sobol_bits; ++k) {
+      v[k] = uint32_t(1) << (sobol_bits - 1 - k);
+    }
+    return;
+  }
+
+  const SobolInit& init = sobol_init[j-1];
+  int s = init.s;
+  for (int k=0; k<s; ++k) {
+    v[k] = init.m[k] << (sobol_bits - 1 - k);
+  }
+  for (int k=s; k<sobol_bits; ++k) {
+    v[k] = v[k-s] ^ (v[k-s] >> s);
+    for (int i=1; i<s; ++i) {
+      if ((init.a >> (s - 1 - i)) & 1) {
+        v[k] ^= v[k-i];
+      }
+    }
+  }
+}
+
+static uint32_t
+rand32(RandStream& rs)
+{
+  return uint32_t(rs.drand() * 4294967296.0);
+}
+
+static uint32_t
+parity(uint32_t x)
+{
+  x ^= x >> 16;
+  x ^= x >> 8;
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return x & 1;
+}
+
+ScrambledSobol::ScrambledSobol(int _dim, int points_per_replicate, int replicates, uint64_t seed)
+  : dim(_dim), npts(points_per_replicate), nrep(replicates)
+{
+  if (dim < 1 || dim > MaxDim()) {
+    BoxLib::Abort("ScrambledSobol: dimension not supported");
+  }
+  if (npts < 1 || nrep < 1) {
+    BoxLib::Abort("ScrambledSobol: need at least one point and one replicate");
+  }
+
+  V.resize(nrep*dim*sobol_bits);
+  shift.resize(nrep*dim);
+
+  std::vector<uint32_t> v(sobol_bits), M(sobol_bits);
+  for (int r=0; r<nrep; ++r) {
+    RandStream rs(seed,r,RAND_TAG_QMC);
+    for (int j=0; j<dim; ++j) {
+      direction_numbers(j,&(v[0]));
+
+      // Random lower triangular matrix with unit diagonal; row k
+      // gives digit k (counted from the most significant) of the
+      // scrambled direction numbers
+      for (int k=0; k<sobol_bits; ++k) {
+        uint32_t diag = uint32_t(1) << (sobol_bits - 1 - k);
+        uint32_t lower = (k == 0 ? 0 : ~uint32_t(0) << (sobol_bits - k));
+        M[k] = diag | (rand32(rs) & lower);
+      }
+
+      uint32_t* Vrj = &(V[(r*dim + j)*sobol_bits]);
+      for (int l=0; l<sobol_bits; ++l) {
+        uint32_t y = 0;
+        for (int k=0; k<sobol_bits; ++k) {
+          y |= parity(M[k] & v[l]) << (sobol_bits - 1 - k);
+        }
+        Vrj[l] = y;
+      }
+      shift[r*dim + j] = rand32(rs);
+    }
+  }
+}
+
+int
+ScrambledSobol::Replicate(int sampleID) const
+{
+  return std::min(sampleID / npts, nrep - 1);
+}
+
+void
+ScrambledSobol::Uniform(int sampleID, Real* u) const
+{
+  int r = Replicate(sampleID);
+  uint32_t index = sampleID - r*npts;
+  for (int j=0; j<dim; ++j) {
+    const uint32_t* Vrj = &(V[(r*dim + j)*sobol_bits]);
+    uint32_t x = shift[r*dim + j];
+    uint32_t i = index;
+    for (int k=0; i!=0; ++k, i>>=1) {
+      if (i & 1) {
+        x ^= Vrj[k];
+      }
+    }
+    u[j] = (x + 0.5) * (1.0 / 4294967296.0);
+  }
+}
+
+void
+ScrambledSobol::Normal(int sampleID, Real* z) const
+{
+  Uniform(sampleID,z);
+  for (int j=0; j<dim; ++j) {
+    z[j] = InvNormalCDF(z[j]);
+  }
+}
+
+// ******************************************************
+// Inverse normal CDF: rational approximation of Acklam (relative
+// error below 1.2e-9), polished with one step of Halley's method
+// ******************************************************
+Real
+InvNormalCDF(Real p)
+{
+  static const Real a[6] = {-3.969683028665376e+01,  2.209460984245205e+02,
+                            -2.759285104469687e+02,  1.383577518672690e+02,
+                            -3.066479806614716e+01,  2.506628277459239e+00};
+  static const Real b[5] = {-5.447609879822406e+01,  1.615858368580409e+02,
+                            -1.556989798598866e+02,  6.680131188771972e+01,
+                            -1.328068155288572e+01};
+  static const Real c[6] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                            -2.400758277161838e+00, -2.549732539343734e+00,
+                             4.374664141464968e+00,  2.938163982698783e+00};
+  static const Real d[4] = { 7.784695709041462e-03,  3.224671290700398e-01,
+                             2.445134137142996e+00,  3.754408661907416e+00};
+  static const Real p_low = 0.02425;
+  static const Real sqrt2pi = 2.50662827463100050242;
+
+  Real x;
+  if (p < p_low) {
+    Real q = std::sqrt(-2*std::log(p));
+    x = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+      ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+  }
+  else if (p <= 1 - p_low) {
+    Real q = p - 0.5;
+    Real r = q*q;
+    x = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q /
+      (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+  }
+  else {
+    Real q = std::sqrt(-2*std::log(1-p));
+    x = -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+      ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+  }
+
+  Real e = 0.5 * erfc(-x/std::sqrt(2.0)) - p;
+  Real u = e * sqrt2pi * std::exp(0.5*x*x);
+  return x - u/(1 + 0.5*x*u);
+}
@@ -0,0 +1,157 @@
+#include <Tracer.H>
+#include <ParallelDescriptor.H>
+#include <Utility.H>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <pthread.h>
+
+namespace
+{
+  struct Event
+  {
+    std::string name;
+    const char* cat;
+    double start, duration;
+  };
+
+  struct Buffer
+  {
+    int tid;
+    std::vector<Event> events;
+  };
+}
+
+static bool enabled = false;
+static std::string trace_file;
+static double start_time = 0;
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<Buffer*> buffers;
+static __thread Buffer* my_buffer = 0;
+
+void
+Tracer::Enable(const std::string& filename)
+{
+  trace_file = filename;
+  ParallelDescriptor::Barrier();
+  start_time = ParallelDescriptor::second();
+  enabled = true;
+}
+
+bool
+Tracer::Enabled()
+{
+  return enabled;
+}
+
+double
+Tracer::Now()
+{
+  return ParallelDescriptor::second() - start_time;
+}
+
+void
+Tracer::Record(const std::string& name, const char* cat, double start)
+{
+  double end = Now();
+  if (my_buffer == 0) {
+    pthread_mutex_lock(&buffers_mutex);
+    my_buffer = new Buffer;
+    my_buffer->tid = buffers.size();
+    buffers.push_back(my_buffer);
+    pthread_mutex_unlock(&buffers_mutex);
+  }
+  Event e;
+  e.name = name;
+  e.cat = cat;
+  e.start = start;
+  e.duration = end - start;
+  my_buffer->events.push_back(e);
+}
+
+static std::string
+Quoted(const std::string& s)
+{
+  std::string q = "\"";
+  for (int i=0; i<s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      q += '\\';
+    }
+    q += (s[i] == '\n' ? ' ' : s[i]);
+  }
+  return q + "\"";
+}
+
+// Events of this rank, as JSON objects each followed by a comma
+static std::string
+RankEvents()
+{
+  int myproc = ParallelDescriptor::MyProc();
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3);
+  os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << myproc
+     << ",\"args\":{\"name\":\"rank " << myproc << "\"}},\n";
+  for (int b=0; b<buffers.size(); ++b) {
+    const Buffer& buf = *buffers[b];
+    for (int i=0; i<buf.events.size(); ++i) {
+      const Event& e = buf.events[i];
+      // Times in microseconds
+      os << "{\"name\":" << Quoted(e.name) << ",\"cat\":\"" << e.cat
+         << "\",\"ph\":\"X\",\"ts\":" << 1.e6*e.start
+         << ",\"dur\":" << 1.e6*e.duration
+         << ",\"pid\":" << myproc << ",\"tid\":" << buf.tid << "},\n";
+    }
+  }
+  return os.str();
+}
+
+void
+Tracer::Write()
+{
+  if (!enabled) {
+    return;
+  }
+
+  std::string events = RankEvents();
+  for (int b=0; b<buffers.size(); ++b) {
+    buffers[b]->events.clear();
+  }
+
+  // Gather the events of all the ranks on the IO rank
+  std::vector<char> all(events.begin(),events.end());
+#ifdef BL_USE_MPI
+  int nprocs = ParallelDescriptor::NProcs();
+  int ioproc = ParallelDescriptor::IOProcessorNumber();
+  if (nprocs > 1) {
+    int len = events.size();
+    std::vector<int> lens(nprocs), offsets(nprocs,0);
+    BL_MPI_REQUIRE( MPI_Gather(&len, 1, MPI_INT, &(lens[0]), 1, MPI_INT,
+                               ioproc, ParallelDescriptor::Communicator()) );
+    int total = 0;
+    for (int p=0; p<nprocs; ++p) {
+      offsets[p] = total;
+      total += lens[p];
+    }
+    all.resize(ParallelDescriptor::IOProcessor() ? total + 1 : 1);
+    BL_MPI_REQUIRE( MPI_Gatherv(const_cast<char*>(events.data()), len, MPI_CHAR,
+                                &(all[0]), &(lens[0]), &(offsets[0]), MPI_CHAR,
+                                ioproc, ParallelDescriptor::Communicator()) );
+    all.resize(ParallelDescriptor::IOProcessor() ? total : 0);
+  }
+#endif
+
+  if (ParallelDescriptor::IOProcessor()) {
+    std::ofstream ofs(trace_file.c_str());
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    // Drop the comma after the last event
+    if (all.size() > 1) {
+      ofs.write(&(all[0]),all.size() - 2);
+    }
+    ofs << "\n]}\n";
+    if (!ofs.good()) {
+      BoxLib::Abort("Tracer::Write: failed to write " + trace_file);
+    }
+  }
+}
@@ -3,13 +3,151 @@
 #include <FArrayBox.H>
 #include <Utility.H>
 #include <ParallelDescriptor.H>
+#include <Tracer.H>
 
 #include <iostream>
 #include <fstream>
-
-static const std::string PlotfileVersion = "UQ_Plotfile_V0";
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const std::string PlotfileVersion_V0 = "UQ_Plotfile_V0";
+static const std::string PlotfileVersion = "UQ_Plotfile_V1";
+static const int CurrentVersion = 1;
 static bool ioproc;
 
+static std::string RealFormat()
+{
+  int one = 1;
+  bool little_endian = *(reinterpret_cast<char*>(&one)) == 1;
+  return (little_endian ? "LE" : "BE");
+}
+
+// Copy len bytes at offset of file name to dst, mapping only the
+// pages that hold them
+static void MapRead(const std::string& name, size_t offset, size_t len, char* dst)
+{
+  if (len == 0) {
+    return;
+  }
+  int fd = open(name.c_str(),O_RDONLY);
+  if (fd < 0) {
+    BoxLib::FileOpenFailed(name);
+  }
+  struct stat st;
+  if (fstat(fd,&st) != 0 || (size_t)st.st_size < offset + len) {
+    close(fd);
+    BoxLib::Abort("UqPlotfile: data file shorter than its header says");
+  }
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t begin = (offset / page) * page;
+  size_t maplen = offset + len - begin;
+  void* p = mmap(0,maplen,PROT_READ,MAP_PRIVATE,fd,begin);
+  close(fd);
+  if (p == MAP_FAILED) {
+    BoxLib::Abort("UqPlotfile: unable to map data file");
+  }
+  std::memcpy(dst,static_cast<char*>(p) + (offset - begin),len);
+  munmap(p,maplen);
+}
+
+static void WriteAll(int fd, const char* buf, size_t len, off_t offset, const std::string& name)
+{
+  while (len > 0) {
+    ssize_t n = pwrite(fd,buf,len,offset);
+    if (n <= 0) {
+      BoxLib::Abort("UqPlotfile: write failed for " + name);
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+}
+
+static void SyncDir(const std::string& dir)
+{
+  int fd = open(dir.c_str(),O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+// Replace file name in dir by contents: the new contents are synced
+// under a temporary name, which is then renamed over name
+static void CommitFile(const std::string& dir, const std::string& name, const std::string& contents)
+{
+  std::string tmp = name + ".new";
+  int fd = open(tmp.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+  if (fd < 0) {
+    BoxLib::FileOpenFailed(tmp);
+  }
+  WriteAll(fd,contents.data(),contents.size(),0,tmp);
+  if (fsync(fd) != 0) {
+    BoxLib::Abort("UqPlotfile: unable to sync " + tmp);
+  }
+  close(fd);
+  if (std::rename(tmp.c_str(),name.c_str()) != 0) {
+    BoxLib::Abort("UqPlotfile: unable to commit " + name);
+  }
+  SyncDir(dir);
+}
+
+static std::string HeaderText(int ndim, int nwalkers, int iter, int iters)
+{
+  std::ostringstream os;
+  os << PlotfileVersion << '\n';
+  os << ndim << '\n';
+  os << nwalkers << '\n';
+  os << iter << '\n';
+  os << iters << '\n';
+  os << sizeof(double) << ' ' << RealFormat() << '\n';
+  return os.str();
+}
+
+// Parse the header file name into ndim, nwalkers, iter, iters and
+// version; returns false if it cannot be opened
+static bool ParseHeader(const std::string& name, int* indata)
+{
+  std::ifstream ifs;
+  ifs.open(name.c_str());
+  if (!ifs.good()) {
+    return false;
+  }
+  std::string pfVersion;
+  ifs >> pfVersion;
+  if (pfVersion == PlotfileVersion) {
+    indata[4] = CurrentVersion;
+  }
+  else if (pfVersion == PlotfileVersion_V0) {
+    indata[4] = 0;
+  }
+  else {
+    BoxLib::Abort("Unknown UqPlotfile version");
+  }
+
+  ifs >> indata[0];
+  ifs >> indata[1];
+  ifs >> indata[2];
+  ifs >> indata[3];
+  if (indata[4] > 0) {
+    int realSize;
+    std::string realFormat;
+    ifs >> realSize >> realFormat;
+    if (realSize != sizeof(double) || realFormat != RealFormat()) {
+      BoxLib::Abort("UqPlotfile written with a different binary format");
+    }
+  }
+  ifs.close();
+  return true;
+}
+
 static void SetIOProc()
 {
   ioproc = ParallelDescriptor::IOProcessor() || ParallelDescriptor::MyProc()<0;
@@ -17,6 +155,7 @@ static void SetIOProc()
 
 
 UqPlotfile::UqPlotfile()
+  : m_version(CurrentVersion), m_ndim(0), m_nwalkers(0), m_iter(0), m_iters(0)
 {
   SetIOProc();
 }
@@ -27,8 +166,8 @@ UqPlotfile::UqPlotfile(const std::vector<double>& x,
                        int                        iter,
                        int                        iters,
                        const std::string&         rng_state)
-  : m_ndim(ndim), m_nwalkers(nwalkers), m_iter(iter),
-    m_iters(iters), m_rstate(rng_state)
+  : m_version(CurrentVersion), m_ndim(ndim), m_nwalkers(nwalkers),
+    m_iter(iter), m_iters(iters), m_rstate(rng_state)
 {
   SetIOProc();
 
@@ -46,10 +185,50 @@ UqPlotfile::UqPlotfile(const std::vector<double>& x,
   }
 }
 
+UqPlotfile::UqPlotfile(const double*      chain,
+                       int                nwalkers,
+                       int                iters,
+                       int                ndim,
+                       int                iter,
+                       const std::string& rng_state)
+  : m_version(CurrentVersion), m_ndim(ndim), m_nwalkers(nwalkers),
+    m_iter(iter), m_iters(iters), m_rstate(rng_state)
+{
+  SetIOProc();
+
+  Box box(IntVect(D_DECL(0,0,0)),IntVect(D_DECL(m_nwalkers-1,m_iters-1,0)));
+  m_fab.resize(box,m_ndim);
+
+  double* data = m_fab.dataPtr();
+  for (int k=0; k<m_nwalkers; ++k) {
+    for (int t=0; t<m_iters; ++t) {
+      const double* x = chain + ((size_t)k*m_iters + t)*m_ndim;
+      for (int j=0; j<m_ndim; ++j) {
+        data[k + (size_t)m_nwalkers*t + (size_t)m_nwalkers*m_iters*j] = x[j];
+      }
+    }
+  }
+}
+
+void
+UqPlotfile::LoadChain(int iter, int iters, double* chain) const
+{
+  BL_ASSERT(iter >= m_iter && m_iter + m_iters >= iter + iters);
+  const double* data = m_fab.dataPtr();
+  for (int k=0; k<m_nwalkers; ++k) {
+    for (int t=0; t<iters; ++t) {
+      double* x = chain + ((size_t)k*iters + t)*m_ndim;
+      for (int j=0; j<m_ndim; ++j) {
+        x[j] = data[k + (size_t)m_nwalkers*(t + iter - m_iter) + (size_t)m_nwalkers*m_iters*j];
+      }
+    }
+  }
+}
+
 std::vector<double>
 UqPlotfile::LoadEnsemble(int iter, int iters) const
 {
-  BL_ASSERT(m_iters >= iter + iters);
+  BL_ASSERT(iter >= m_iter && m_iter + m_iters >= iter + iters);
   size_t len = m_nwalkers * m_ndim * iters;
   std::vector<double> result(len);
   for (int k=0; k<m_nwalkers; ++k) {
@@ -67,12 +246,149 @@ UqPlotfile::LoadEnsemble(int iter, int iters) const
 void
 UqPlotfile::Write(const std::string& filename) const
 {
+  TraceScope trace("UqPlotfile::Write","io");
   BuildDir(filename);
   WriteHeader(filename);
   WriteSamples(filename);
   WriteRState(filename);
 }
 
+void
+UqPlotfile::Append(const std::string& filename) const
+{
+  if (!ioproc) {
+    return;
+  }
+  TraceScope trace("UqPlotfile::Append","io");
+
+  int indata[5];
+  int file_iter = m_iter;
+  int file_iters = 0;
+  if (ParseHeader(HeaderName(filename),indata)) {
+    if (indata[4] != CurrentVersion
+        || indata[0] != m_ndim
+        || indata[1] != m_nwalkers) {
+      BoxLib::Abort("UqPlotfile::Append: file does not match the samples");
+    }
+    if (indata[2] + indata[3] != m_iter) {
+      BoxLib::Abort("UqPlotfile::Append: samples do not continue the file");
+    }
+    file_iter = indata[2];
+    file_iters = indata[3];
+  }
+  else {
+    BuildDir(filename);
+  }
+
+  // Chunks go after the committed ones, overwriting any left by an
+  // interrupted append
+  std::string name = ChunkName(filename);
+  int fd = open(name.c_str(),O_WRONLY | O_CREAT,0644);
+  if (fd < 0) {
+    BoxLib::FileOpenFailed(name);
+  }
+  size_t chunk = (size_t)m_nwalkers * m_ndim;
+  std::vector<double> buf(chunk);
+  for (int t=0; t<m_iters; ++t) {
+    PackChunk(t,buf);
+    WriteAll(fd,reinterpret_cast<const char*>(&(buf[0])),chunk*sizeof(double),
+             (off_t)(file_iters + t)*chunk*sizeof(double),name);
+  }
+  if (fsync(fd) != 0) {
+    BoxLib::Abort("UqPlotfile: unable to sync " + name);
+  }
+  close(fd);
+
+  CommitFile(filename,RStateName(filename),m_rstate);
+  CommitFile(filename,HeaderName(filename),
+             HeaderText(m_ndim,m_nwalkers,file_iter,file_iters + m_iters));
+}
+
+void
+UqPlotfile::WriteDistributed(const std::string&         filename,
+                             const std::vector<double>& x_loc,
+                             int                        ndim,
+                             int                        nwalkers,
+                             int                        iter,
+                             int                        iters,
+                             int                        walker_lo,
+                             int                        nwalkers_loc,
+                             int                        iter_lo,
+                             int                        iters_loc,
+                             const std::string&         rng_state)
+{
+  SetIOProc();
+  TraceScope trace("UqPlotfile::WriteDistributed","io");
+  BL_ASSERT(walker_lo >= 0 && walker_lo + nwalkers_loc <= nwalkers);
+  BL_ASSERT(iter_lo >= 0 && iter_lo + iters_loc <= iters);
+  size_t len = (size_t)nwalkers_loc * iters_loc * ndim;
+  BL_ASSERT(x_loc.size() >= len);
+
+  BuildDir(filename);
+  std::string name = ChunkName(filename);
+
+#ifdef BL_USE_MPI
+  ParallelDescriptor::Barrier();
+
+  // The file is an array [iters][ndim][nwalkers], of which this rank
+  // holds the block [iters_loc][ndim][nwalkers_loc]
+  MPI_Comm comm = ParallelDescriptor::Communicator();
+  MPI_File fh;
+  if (MPI_File_open(comm,const_cast<char*>(name.c_str()),
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                    MPI_INFO_NULL,&fh) != MPI_SUCCESS) {
+    BoxLib::FileOpenFailed(name);
+  }
+  BL_MPI_REQUIRE( MPI_File_set_size(fh,(MPI_Offset)iters*ndim*nwalkers*sizeof(double)) );
+
+  MPI_Datatype filetype = MPI_DOUBLE;
+  if (len > 0) {
+    int sizes[3] = {iters, ndim, nwalkers};
+    int subsizes[3] = {iters_loc, ndim, nwalkers_loc};
+    int starts[3] = {iter_lo, 0, walker_lo};
+    BL_MPI_REQUIRE( MPI_Type_create_subarray(3,sizes,subsizes,starts,
+                                             MPI_ORDER_C,MPI_DOUBLE,&filetype) );
+    BL_MPI_REQUIRE( MPI_Type_commit(&filetype) );
+  }
+  BL_MPI_REQUIRE( MPI_File_set_view(fh,0,MPI_DOUBLE,filetype,
+                                    const_cast<char*>("native"),MPI_INFO_NULL) );
+  MPI_Status status;
+  if (MPI_File_write_all(fh,len == 0 ? 0 : const_cast<double*>(&(x_loc[0])),
+                         (int)len,MPI_DOUBLE,&status) != MPI_SUCCESS) {
+    BoxLib::Abort("UqPlotfile: write failed for " + name);
+  }
+  BL_MPI_REQUIRE( MPI_File_sync(fh) );
+  BL_MPI_REQUIRE( MPI_File_close(&fh) );
+  if (len > 0) {
+    BL_MPI_REQUIRE( MPI_Type_free(&filetype) );
+  }
+
+  ParallelDescriptor::Barrier();
+#else
+  int fd = open(name.c_str(),O_WRONLY | O_CREAT,0644);
+  if (fd < 0 || ftruncate(fd,(off_t)iters*ndim*nwalkers*sizeof(double)) != 0) {
+    BoxLib::FileOpenFailed(name);
+  }
+  for (int t=0; t<iters_loc; ++t) {
+    for (int j=0; j<ndim; ++j) {
+      off_t offset = (((off_t)(iter_lo + t)*ndim + j)*nwalkers + walker_lo)*sizeof(double);
+      WriteAll(fd,reinterpret_cast<const char*>(&(x_loc[((size_t)t*ndim + j)*nwalkers_loc])),
+               nwalkers_loc*sizeof(double),offset,name);
+    }
+  }
+  if (fsync(fd) != 0) {
+    BoxLib::Abort("UqPlotfile: unable to sync " + name);
+  }
+  close(fd);
+#endif
+
+  // The header goes last, once all the samples are on disk
+  if (ioproc) {
+    CommitFile(filename,RStateName(filename),rng_state);
+    CommitFile(filename,HeaderName(filename),HeaderText(ndim,nwalkers,iter,iters));
+  }
+}
+
 void
 UqPlotfile::Read(const std::string& filename)
 {
@@ -91,20 +407,130 @@ UqPlotfile::Read_serial(const std::string& filename)
   ReadRState(filename);
 }
 
+void
+UqPlotfile::ReadInfo(const std::string& filename)
+{
+  SetIOProc();
+  ReadHeader(filename);
+  ReadRState(filename);
+}
+
+void
+UqPlotfile::Read(const std::string& filename, int iter, int iters)
+{
+  SetIOProc();
+  ReadHeader(filename);
+  ReadRange(filename,iter,iters,true);
+  ReadRState(filename);
+}
+
+void
+UqPlotfile::Read_serial(const std::string& filename, int iter, int iters)
+{
+  SetIOProc();
+  ReadHeader(filename);
+  ReadRange(filename,iter,iters,false);
+  ReadRState(filename);
+}
+
+void
+UqPlotfile::ReadRange(const std::string& filename, int iter, int iters, bool bcast)
+{
+  if (iters < 1 || iter < m_iter || iter + iters > m_iter + m_iters) {
+    BoxLib::Abort("UqPlotfile: requested iterations not in file");
+  }
+
+  if (m_version == 0) {
+    // No index, read everything and keep the range
+    if (bcast) {
+      ReadSamples(filename);
+    } else {
+      ReadSamples_serial(filename);
+    }
+    if (ioproc || bcast) {
+      std::vector<double> x = LoadEnsemble(iter,iters);
+      Box box(IntVect(D_DECL(0,0,0)),IntVect(D_DECL(m_nwalkers-1,iters-1,0)));
+      m_fab.resize(box,m_ndim);
+      std::copy(x.begin(),x.end(),m_fab.dataPtr());
+    }
+    m_iter = iter;
+    m_iters = iters;
+    return;
+  }
+
+  if (ioproc) {
+    ReadChunks(filename,iter,iters);
+  }
+  else if (bcast) {
+    Box box(IntVect(D_DECL(0,0,0)),IntVect(D_DECL(m_nwalkers-1,iters-1,0)));
+    m_fab.resize(box,m_ndim);
+  }
+  m_iter = iter;
+  m_iters = iters;
+
+  if (bcast && ParallelDescriptor::MyProc()>=0) {
+    ParallelDescriptor::Bcast(m_fab.dataPtr(),m_fab.box().numPts()*m_ndim);
+  }
+}
+
+// Chunk of iteration t holds component j of walker k at j*nwalkers + k
+void
+UqPlotfile::ReadChunks(const std::string& filename, int iter, int iters)
+{
+  size_t chunk = (size_t)m_nwalkers * m_ndim;
+  std::vector<double> buf(chunk * iters);
+  MapRead(ChunkName(filename),(iter - m_iter) * chunk * sizeof(double),
+          buf.size() * sizeof(double),reinterpret_cast<char*>(&(buf[0])));
+
+  Box box(IntVect(D_DECL(0,0,0)),IntVect(D_DECL(m_nwalkers-1,iters-1,0)));
+  m_fab.resize(box,m_ndim);
+  double* data = m_fab.dataPtr();
+  for (int t=0; t<iters; ++t) {
+    for (int j=0; j<m_ndim; ++j) {
+      for (int k=0; k<m_nwalkers; ++k) {
+        data[k + (size_t)m_nwalkers*t + (size_t)m_nwalkers*iters*j] = buf[t*chunk + j*m_nwalkers + k];
+      }
+    }
+  }
+}
+
 void
 UqPlotfile::WriteSamples(const std::string& filename) const
 {
   if (ioproc) {
     std::ofstream ofs;
-    ofs.open(DataName(filename).c_str(),std::ios::out);
-    m_fab.writeOn(ofs);
+    ofs.open(ChunkName(filename).c_str(),std::ios::out | std::ios::binary);
+    if (!ofs.good())
+      BoxLib::FileOpenFailed(ChunkName(filename));
+    size_t chunk = (size_t)m_nwalkers * m_ndim;
+    std::vector<double> buf(chunk);
+    for (int t=0; t<m_iters; ++t) {
+      PackChunk(t,buf);
+      ofs.write(reinterpret_cast<const char*>(&(buf[0])),chunk*sizeof(double));
+    }
     ofs.close();
   }
 }
 
+void
+UqPlotfile::PackChunk(int t, std::vector<double>& chunk) const
+{
+  const double* data = m_fab.dataPtr();
+  for (int j=0; j<m_ndim; ++j) {
+    for (int k=0; k<m_nwalkers; ++k) {
+      chunk[j*m_nwalkers + k] = data[k + (size_t)m_nwalkers*t + (size_t)m_nwalkers*m_iters*j];
+    }
+  }
+}
+
 void
 UqPlotfile::ReadSamples(const std::string& filename)
 {
+  if (m_version > 0) {
+    ReadRange(filename,m_iter,m_iters,true);
+    return;
+  }
+
   if (ioproc) {
     std::ifstream ifs;
     ifs.open(DataName(filename).c_str());
@@ -140,6 +566,11 @@ UqPlotfile::ReadSamples(const std::string& filename)
 void
 UqPlotfile::ReadSamples_serial(const std::string& filename)
 {
+  if (m_version > 0) {
+    ReadRange(filename,m_iter,m_iters,false);
+    return;
+  }
+
   if (ioproc) {
     std::ifstream ifs;
     ifs.open(DataName(filename).c_str());
@@ -165,11 +596,7 @@ UqPlotfile::WriteHeader(const std::string& filename) const
   if (ioproc) {
     std::ofstream ofs;
     ofs.open(HeaderName(filename).c_str());
-    ofs << PlotfileVersion << '\n';
-    ofs << m_ndim << '\n';
-    ofs << m_nwalkers << '\n';
-    ofs << m_iter << '\n';
-    ofs << m_iters << '\n';
+    ofs << HeaderText(m_ndim,m_nwalkers,m_iter,m_iters);
     ofs.close();
   }
 }
@@ -177,32 +604,22 @@ UqPlotfile::WriteHeader(const std::string& filename) const
 void
 UqPlotfile::ReadHeader(const std::string& filename)
 {
-  int indata[4];
+  int indata[5];
 
   if (ioproc) {
-    std::ifstream ifs;
-    ifs.open(HeaderName(filename).c_str());
-    if (!ifs.good())
+    if (!ParseHeader(HeaderName(filename),indata))
       BoxLib::FileOpenFailed(filename);
-    std::string pfVersion;
-    ifs >> pfVersion;
-    BL_ASSERT(pfVersion == PlotfileVersion);
-
-    ifs >> indata[0];
-    ifs >> indata[1];
-    ifs >> indata[2];
-    ifs >> indata[3];
-    ifs.close();
   }
 
   if (ParallelDescriptor::MyProc()>=0) {
-    ParallelDescriptor::Bcast(indata,4);
+    ParallelDescriptor::Bcast(indata,5);
   }
 
   m_ndim = indata[0];
   m_nwalkers = indata[1];
   m_iter = indata[2];
   m_iters = indata[3];
+  m_version = indata[4];
 }
 
 void
@@ -254,7 +671,7 @@ UqPlotfile::ReadRState(const std::string& filename)
 }
 
 void
-UqPlotfile::BuildDir(const std::string& filename) const
+UqPlotfile::BuildDir(const std::string& filename)
 {
   if (ioproc)
     if (!BoxLib::UtilCreateDirectory(filename, 0755))
@@ -262,19 +679,135 @@ UqPlotfile::BuildDir(const std::string& filename) const
 }
 
 std::string
-UqPlotfile::HeaderName(const std::string& filename) const
+UqPlotfile::HeaderName(const std::string& filename)
 {
   return filename + "/Header";
 }
 
 std::string
-UqPlotfile::DataName(const std::string& filename) const
+UqPlotfile::DataName(const std::string& filename)
 {
   return filename + "/Data.fab";
 }
 
 std::string
-UqPlotfile::RStateName(const std::string& filename) const
+UqPlotfile::ChunkName(const std::string& filename)
+{
+  return filename + "/Data.bin";
+}
+
+std::string
+UqPlotfile::RStateName(const std::string& filename)
 {
   return filename + "/RState.pic";
 }
+
+UqPlotfileWriter::UqPlotfileWriter(const std::string& filename, int max_queued)
+  : m_filename(filename), m_max_queued(max_queued), m_busy(false), m_done(false)
+{
+  SetIOProc();
+  m_ioproc = ioproc;
+  BL_ASSERT(m_max_queued > 0);
+  if (m_ioproc) {
+    pthread_mutex_init(&m_mutex,0);
+    pthread_cond_init(&m_cond,0);
+    if (pthread_create(&m_thread,0,Work,this) != 0) {
+      BoxLib::Abort("UqPlotfileWriter: unable to start writer thread");
+    }
+  }
+}
+
+UqPlotfileWriter::~UqPlotfileWriter()
+{
+  if (m_ioproc) {
+    pthread_mutex_lock(&m_mutex);
+    m_done = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+    pthread_join(m_thread,0);
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+  }
+}
+
+void
+UqPlotfileWriter::Append(const std::vector<double>& x,
+                         int                        ndim,
+                         int                        nwalkers,
+                         int                        iter,
+                         int                        iters,
+                         const std::string&         rng_state)
+{
+  if (m_ioproc) {
+    Enqueue(new UqPlotfile(x,ndim,nwalkers,iter,iters,rng_state));
+  }
+}
+
+void
+UqPlotfileWriter::AppendChain(const double*      chain,
+                              int                nwalkers,
+                              int                iters,
+                              int                ndim,
+                              int                iter,
+                              const std::string& rng_state)
+{
+  if (m_ioproc) {
+    Enqueue(new UqPlotfile(chain,nwalkers,iters,ndim,iter,rng_state));
+  }
+}
+
+void
+UqPlotfileWriter::Enqueue(UqPlotfile* pf)
+{
+  pthread_mutex_lock(&m_mutex);
+  while ((int)m_queue.size() >= m_max_queued) {
+    pthread_cond_wait(&m_cond,&m_mutex);
+  }
+  m_queue.push_back(pf);
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void
+UqPlotfileWriter::Flush()
+{
+  if (!m_ioproc) {
+    return;
+  }
+  pthread_mutex_lock(&m_mutex);
+  while (!m_queue.empty() || m_busy) {
+    pthread_cond_wait(&m_cond,&m_mutex);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Writer thread: append queued samples until told to stop with an
+// empty queue
+void*
+UqPlotfileWriter::Work(void* writer)
+{
+  UqPlotfileWriter* w = static_cast<UqPlotfileWriter*>(writer);
+  pthread_mutex_lock(&w->m_mutex);
+  while (true) {
+    while (w->m_queue.empty() && !w->m_done) {
+      pthread_cond_wait(&w->m_cond,&w->m_mutex);
+    }
+    if (w->m_queue.empty()) {
+      break;
+    }
+    UqPlotfile* pf = w->m_queue.front();
+    w->m_queue.pop_front();
+    w->m_busy = true;
+    pthread_cond_broadcast(&w->m_cond);
+    pthread_mutex_unlock(&w->m_mutex);
+
+    pf->Append(w->m_filename);
+    delete pf;
+
+    pthread_mutex_lock(&w->m_mutex);
+    w->m_busy = false;
+    pthread_cond_broadcast(&w->m_cond);
+  }
+  pthread_mutex_unlock(&w->m_mutex);
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include <Driver.H>
+#include <ChemDriver.H>
+#include <Minimizer.H>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <sys/resource.h>
+
+#include <ParmParse.H>
+#include <ParallelDescriptor.H>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// A scenario runs once and returns the number of likelihood (or
+// single experiment) evaluations it made
+typedef int (*Scenario)(void);
+
+static std::vector<Real> bench_params;
+static int bench_expt = -1;
+
+static int
+single_experiment()
+{
+  ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  ParmParse ppe(expt_manager.ExperimentNames()[bench_expt].c_str());
+  Real data_tstart = 0; ppe.query("data_tstart",data_tstart);
+  Real data_tend = 0; ppe.query("data_tend",data_tend);
+  int data_num_points = -1; ppe.query("data_num_points",data_num_points);
+  std::vector<Real> data;
+  std::pair<bool,int> retVal
+    = expt_manager.Experiment(bench_expt).GetMeasurements(data,data_num_points,data_tstart,data_tend);
+  if (!retVal.first) {
+    std::cout << "Benchmark experiment failed: "
+              << SimulatedExperiment::ErrorString(retVal.second) << std::endl;
+  }
+  return 1;
+}
+
+static int
+likelihood()
+{
+  Driver::LogLikelihood(bench_params);
+  return 1;
+}
+
+static int
+gradient()
+{
+  std::vector<Real> g;
+  Minimizer::FD_Gradient((void*)Driver::mystruct,bench_params,g);
+  return 2 * bench_params.size();
+}
+
+static int
+hessian()
+{
+  Minimizer::FD_Hessian((void*)Driver::mystruct,bench_params);
+  int n = bench_params.size();
+  return 2 * n * (n + 1);
+}
+
+// Experiment to benchmark: the one named by the input name, else the
+// first of the given kind (-1 if none)
+static int
+find_experiment(const std::string& name, int zeroD_type, bool premix)
+{
+  ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  const std::vector<std::string>& names = expt_manager.ExperimentNames();
+  ParmParse pp("benchmark");
+  if (pp.countval(name.c_str())) {
+    std::string expt; pp.get(name.c_str(),expt);
+    std::vector<std::string>::const_iterator it = std::find(names.begin(),names.end(),expt);
+    if (it == names.end()) {
+      BoxLib::Abort("benchmark." + name + ": no experiment " + expt);
+    }
+    return it - names.begin();
+  }
+  for (int i=0; i<expt_manager.size(); ++i) {
+    SimulatedExperiment& expt = expt_manager.Experiment(i);
+    ZeroDReactor* zeroD = dynamic_cast<ZeroDReactor*>(&expt);
+    if ((premix && dynamic_cast<PREMIXReactor*>(&expt) != 0)
+        || (zeroD != 0 && zeroD->ReactorType() == zeroD_type)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static long
+max_rss_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF,&usage);
+  return usage.ru_maxrss;
+}
+
+// Benchmark of the evaluation stack, on a single rank, for comparing
+// performance from commit to commit.  With the experiments and
+// parameters of the inputs file, at the prior mean, the scenarios
+// (benchmark.scenarios, default all) are
+//   zeroD_CV, zeroD_CP: the first constant volume and pressure 0D
+//       experiment (or benchmark.cv_experiment, cp_experiment)
+//   premix_cold, premix_warm: the first PREMIX experiment (or
+//       benchmark.premix_experiment), solved from the input file, and
+//       restarted from the baseline solution
+//   likelihood: the log likelihood
+//   gradient, hessian: the finite difference gradient and Hessian of
+//       the negative log likelihood
+// The likelihood scenarios run over 1 to benchmark.max_threads
+// threads (default: all), the experiments over threads; a single
+// experiment runs on one thread.  Each case runs once untimed, then
+// benchmark.repeats (default 3) times, and the fastest run is kept.
+//
+// The results go to benchmark.out_file (default benchmark.dat), one
+// line per case after comment lines starting with #:
+//   scenario threads evaluations seconds evals_per_second efficiency max_rss_kb
+// where efficiency is the speedup over one thread divided by the
+// threads, and max_rss_kb the process high-water mark so far.  Cases
+// whose experiment is absent from the inputs are left out.
+int
+main (int   argc,
+      char* argv[])
+{
+#ifdef BL_USE_MPI
+  MPI_Init (&argc, &argv);
+  Driver driver(argc,argv,1);
+  driver.SetComm(MPI_COMM_WORLD);
+  driver.init(argc,argv);
+#else
+  Driver driver(argc,argv,0);
+#endif
+  driver.SetParallelModeThreaded();
+
+  if (ParallelDescriptor::NProcs() > 1) {
+    BoxLib::Abort("benchmarkEval runs on a single rank");
+  }
+
+  ParmParse pp("benchmark");
+  int max_threads = 1;
+#ifdef _OPENMP
+  max_threads = omp_get_max_threads();
+#endif
+  pp.query("max_threads",max_threads);
+  int repeats = 3; pp.query("repeats",repeats);
+  if (repeats < 1) {
+    BoxLib::Abort("benchmark.repeats must be at least 1");
+  }
+  std::string out_file = "benchmark.dat"; pp.query("out_file",out_file);
+
+  std::vector<std::string> scenarios;
+  int nscen = pp.countval("scenarios");
+  if (nscen > 0) {
+    pp.getarr("scenarios",scenarios,0,nscen);
+  }
+  else {
+    const char* all[] = {"zeroD_CV", "zeroD_CP", "premix_cold", "premix_warm",
+                         "likelihood", "gradient", "hessian"};
+    scenarios.assign(all, all + 7);
+  }
+
+  bench_params = Driver::PriorMean();
+
+  std::ofstream ofs(out_file.c_str());
+  ofs << "# benchmarkEval 1\n";
+  ofs << "# inputs " << (argc > 1 ? argv[1] : "") << '\n';
+  ofs << "# scenario threads evaluations seconds evals_per_second efficiency max_rss_kb\n";
+
+  for (int s=0; s<scenarios.size(); ++s) {
+    const std::string& name = scenarios[s];
+    Scenario scenario = 0;
+    bool threaded = true;
+    PREMIXReactor* premix = 0;
+    if (name == "zeroD_CV" || name == "zeroD_CP") {
+      bool cv = (name == "zeroD_CV");
+      bench_expt = find_experiment(cv ? "cv_experiment" : "cp_experiment",
+                                   cv ? ZeroDReactor::CONSTANT_VOLUME : ZeroDReactor::CONSTANT_PRESSURE,
+                                   false);
+      scenario = single_experiment;
+      threaded = false;
+    }
+    else if (name == "premix_cold" || name == "premix_warm") {
+      bench_expt = find_experiment("premix_experiment",-1,true);
+      if (bench_expt >= 0) {
+        premix = dynamic_cast<PREMIXReactor*>(&(driver.mystruct->expt_manager.Experiment(bench_expt)));
+        if (premix == 0) {
+          BoxLib::Abort("benchmark.premix_experiment is not a PREMIX experiment");
+        }
+        premix->SetWarmStart(name == "premix_warm");
+      }
+      scenario = single_experiment;
+      threaded = false;
+    }
+    else if (name == "likelihood") {
+      scenario = likelihood;
+    }
+    else if (name == "gradient") {
+      scenario = gradient;
+    }
+    else if (name == "hessian") {
+      scenario = hessian;
+    }
+    else {
+      BoxLib::Abort("benchmark.scenarios: unknown scenario " + name);
+    }
+    if (scenario == single_experiment && bench_expt < 0) {
+      std::cout << "Skipping " << name << ": no such experiment in the inputs" << std::endl;
+      continue;
+    }
+
+    Real rate_1 = 0;
+    for (int nthreads=1; nthreads<=(threaded ? max_threads : 1); ++nthreads) {
+#ifdef _OPENMP
+      omp_set_num_threads(nthreads);
+#endif
+      scenario();
+      int evals = 0;
+      Real best = -1;
+      for (int r=0; r<repeats; ++r) {
+        Real start = ParallelDescriptor::second();
+        evals = scenario();
+        Real elapsed = ParallelDescriptor::second() - start;
+        best = (r == 0 ? elapsed : std::min(best,elapsed));
+      }
+      Real rate = evals / best;
+      if (nthreads == 1) {
+        rate_1 = rate;
+      }
+      Real efficiency = rate / (rate_1 * nthreads);
+      long rss = max_rss_kb();
+
+      std::ostringstream line;
+      line << std::setprecision(6) << name << " " << nthreads << " " << evals << " "
+           << best << " " << rate << " " << efficiency << " " << rss;
+      ofs << line.str() << std::endl;
+      std::cout << line.str() << std::endl;
+    }
+
+    if (premix != 0) {
+      premix->SetWarmStart(true);
+    }
+  }
+  ofs.close();
+
+  BoxLib::Finalize();
+
+#ifdef BL_USE_MPI
+  MPI_Finalize();
+#endif
+}
@@ -0,0 +1,268 @@
+#include <Driver.H>
+#include <ChemDriver.H>
+#include <EnsembleSampler.H>
+#include <DelayedAcceptanceSampler.H>
+#include <Rand.H>
+#include <Utility.H>
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <limits>
+
+#include <ParmParse.H>
+#include <UqPlotfile.H>
+
+#include <ParallelDescriptor.H>
+#include <ParallelGroups.H>
+
+// Log posterior of a batch of parameter vectors.  Driver::LogLikelihood
+// returns a positive flag for failed or out-of-bounds samples, which
+// have zero probability.
+static void
+log_posterior(const Real* x, int n, Real* logp)
+{
+  Driver::LogLikelihoodBatch(x,n,logp);
+  for (int i=0; i<n; ++i) {
+    if (logp[i] > 0) {
+      logp[i] = -std::numeric_limits<Real>::infinity();
+    }
+  }
+}
+
+// Log posterior at the fidelity level screen_fidelity, for the
+// screening stage of delayed acceptance
+static int screen_fidelity = 0;
+static void
+log_posterior_screen(const Real* x, int n, Real* logp)
+{
+  Driver::SetFidelity(screen_fidelity);
+  log_posterior(x,n,logp);
+  Driver::SetFidelity(0);
+}
+
+static std::string
+plotfile_name(const std::string& prefix, int step, int nsteps, int ndigits)
+{
+  std::ostringstream os;
+  os << prefix << '_' << std::setfill('0') << std::setw(ndigits) << step
+     << '_' << std::setw(ndigits) << step + nsteps - 1;
+  return os.str();
+}
+
+// MCMC run entirely in C++.  Options follow UqBox_parallel.py:
+// nwalkers, maxStep, outFilePrefix, outFilePeriod, seed, restartFile.
+// With outFileAppend = 1, every outFilePeriod steps are appended to
+// the single plotfile outFilePrefix, in the background, instead of
+// written to a new plotfile; restartFile may then be that plotfile.
+//
+// mcmc_method = ensemble (default): affine-invariant ensemble sampler,
+//   as emcee, with stretch scale emcee_stepsize and a fraction
+//   de_fraction of differential evolution moves.
+// mcmc_method = delayed_acceptance: nwalkers random walk Metropolis
+//   chains, proposal std da_step times the ensemble std, screened with
+//   a Gaussian process surrogate of the log posterior (length scales
+//   da_length_scale times the ensemble std, at most da_max_points
+//   points) before the true evaluation.  The surrogate learns from the
+//   evaluations of the first da_adapt_steps steps (default 500), which
+//   are burn-in, and is then frozen so the chains target the exact
+//   posterior; -1 never freezes it.  With da_fidelity > 0, the
+//   proposals are screened with the log posterior at that fidelity
+//   level of the experiments (see fidelity.* inputs) instead.
+//
+// Under MPI, the ranks are split into groups of group_size (default
+// 1); the walkers are shared over the groups, and the experiments of
+// each evaluation over the ranks of a group.
+int
+main (int   argc,
+      char* argv[])
+{
+#ifdef BL_USE_MPI
+  MPI_Init (&argc, &argv);
+  Driver driver(argc,argv,1);
+  driver.SetComm(MPI_COMM_WORLD);
+  driver.init(argc,argv);
+#else
+  Driver driver(argc,argv,0);
+#endif
+
+  bool ioproc = ParallelDescriptor::IOProcessor();
+
+  ParmParse pp;
+
+  ParameterManager& parameter_manager = driver.mystruct->parameter_manager;
+  ExperimentManager& expt_manager = driver.mystruct->expt_manager;
+  expt_manager.SetVerbose(false);
+
+  // Each group of group_size ranks evaluates its part of the ensemble,
+  // sample after sample, with the experiments of each sample over
+  // threads with one rank per group, else over the ranks of the group
+  int group_size = 1; pp.query("group_size",group_size);
+  ParallelGroups::Split(group_size);
+  if (ParallelGroups::GroupSize() > 1) {
+    expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_RANK);
+  }
+  else {
+    expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_THREAD);
+  }
+
+  const std::vector<Real>& prior_mean = parameter_manager.PriorMean();
+  const std::vector<Real>& ensemble_std = parameter_manager.EnsembleSTD();
+  int ndim = ensemble_std.size();
+
+  int nwalkers; pp.get("nwalkers",nwalkers);
+  int maxStep; pp.get("maxStep",maxStep);
+  std::string outFilePrefix; pp.get("outFilePrefix",outFilePrefix);
+  int outFilePeriod; pp.get("outFilePeriod",outFilePeriod);
+  int seed = 0; pp.query("seed",seed);
+  std::string restartFile = ""; pp.query("restartFile",restartFile);
+  Real emcee_stepsize = 2; pp.query("emcee_stepsize",emcee_stepsize);
+  Real de_fraction = 0; pp.query("de_fraction",de_fraction);
+  std::string mcmc_method = "ensemble"; pp.query("mcmc_method",mcmc_method);
+  bool outFileAppend = false; pp.query("outFileAppend",outFileAppend);
+
+  if (ioproc) {
+    std::cout << "     nwalkers: " << nwalkers << std::endl;
+    std::cout << "      maxStep: " << maxStep << std::endl;
+    std::cout << "outFilePrefix: " << outFilePrefix << std::endl;
+    std::cout << "outFilePeriod: " << outFilePeriod << std::endl;
+    std::cout << "         seed: " << seed << std::endl;
+    std::cout << "  restartFile: " << restartFile << std::endl;
+    std::cout << "Number of Parameters: " << ndim << std::endl;
+    std::cout << "MCMC method: " << mcmc_method << std::endl;
+  }
+
+  MCMCSampler* sampler = 0;
+  DelayedAcceptanceSampler* da_sampler = 0;
+  if (mcmc_method == "ensemble") {
+    if (ioproc) {
+      std::cout << "emcee stepsize: " << emcee_stepsize << std::endl;
+      std::cout << "DE fraction: " << de_fraction << std::endl;
+    }
+    sampler = new EnsembleSampler(ndim,nwalkers,log_posterior,emcee_stepsize,de_fraction,seed);
+  }
+  else if (mcmc_method == "delayed_acceptance") {
+    Real da_step = 0.5; pp.query("da_step",da_step);
+    Real da_length_scale = 1; pp.query("da_length_scale",da_length_scale);
+    int da_max_points = 500; pp.query("da_max_points",da_max_points);
+    int da_adapt_steps = 500; pp.query("da_adapt_steps",da_adapt_steps);
+    pp.query("da_fidelity",screen_fidelity);
+    std::vector<Real> proposal_std(ndim), length_scale(ndim);
+    for (int j=0; j<ndim; ++j) {
+      proposal_std[j] = da_step*ensemble_std[j];
+      length_scale[j] = da_length_scale*ensemble_std[j];
+    }
+    if (screen_fidelity > 0) {
+      if (screen_fidelity >= Driver::NumFidelityLevels()) {
+        BoxLib::Abort("da_fidelity is not a fidelity level defined by the fidelity.* inputs");
+      }
+      if (ioproc) {
+        std::cout << "Screening with fidelity level " << screen_fidelity << std::endl;
+      }
+      da_sampler = new DelayedAcceptanceSampler(ndim,nwalkers,log_posterior,
+                                                proposal_std,log_posterior_screen,seed);
+    }
+    else {
+      GPSurrogate surrogate(length_scale,da_max_points);
+      da_sampler = new DelayedAcceptanceSampler(ndim,nwalkers,log_posterior,
+                                                proposal_std,surrogate,seed);
+      da_sampler->SetAdaptSteps(da_adapt_steps);
+      if (ioproc && da_adapt_steps >= 0) {
+        std::cout << "Surrogate frozen from step " << da_adapt_steps << std::endl;
+      }
+    }
+    sampler = da_sampler;
+  }
+  else {
+    BoxLib::Abort("Invalid value for mcmc_method");
+  }
+
+  std::vector<Real> x(nwalkers*ndim);
+  if (restartFile == "") {
+    for (int k=0; k<nwalkers; ++k) {
+      RandStream rs(seed,k,RAND_TAG_PROPOSAL);
+      rs.FillNormal(&(x[k*ndim]),ndim);
+      for (int j=0; j<ndim; ++j) {
+        x[k*ndim + j] = prior_mean[j] + ensemble_std[j]*x[k*ndim + j];
+      }
+    }
+    sampler->SetEnsemble(x);
+  }
+  else {
+    if (ioproc) {
+      std::cout << "Restarting from " << restartFile << std::endl;
+    }
+    UqPlotfile pf;
+    pf.ReadInfo(restartFile);
+    if (pf.NWALKERS() != nwalkers || pf.NDIM() != ndim) {
+      BoxLib::Abort("restartFile does not match nwalkers and the number of parameters");
+    }
+    int iter = pf.ITER() + pf.NITERS() - 1;
+    pf.Read(restartFile,iter,1);
+    std::vector<Real> p0 = pf.LoadEnsemble(iter,1);
+    for (int k=0; k<nwalkers; ++k) {
+      for (int j=0; j<ndim; ++j) {
+        x[k*ndim + j] = p0[k + nwalkers*j];
+      }
+    }
+    sampler->Restart(pf.RSTATE(),x);
+    if (sampler->Step() != iter + 1) {
+      BoxLib::Abort("Random state in restartFile does not match its last step");
+    }
+  }
+
+  if (ioproc) {
+    std::cout << "Sampling..." << std::endl;
+  }
+
+  int ndigits = int(std::log10(Real(maxStep))) + 1;
+  std::vector<Real> chain;
+  UqPlotfileWriter* writer = 0;
+  if (outFileAppend) {
+    writer = new UqPlotfileWriter(outFilePrefix);
+  }
+  while (sampler->Step() < maxStep) {
+    int step = sampler->Step();
+    int nSteps = std::min(outFilePeriod, maxStep - step);
+    sampler->Run(nSteps,chain);
+
+    if (ioproc) {
+      std::cout << "Mean acceptance fraction: " << sampler->AcceptanceFraction() << std::endl;
+      if (da_sampler) {
+        std::cout << "Fraction of proposals evaluated: " << da_sampler->EvaluatedFraction();
+        if (da_sampler->UsesSurrogate()) {
+          std::cout << " (surrogate points: " << da_sampler->Surrogate().NumPoints() << ")";
+        }
+        std::cout << std::endl;
+      }
+    }
+
+    if (writer) {
+      if (ioproc) {
+        std::cout << "Appending steps " << step << " to " << step + nSteps - 1
+                  << " to plotfile: " << outFilePrefix << std::endl;
+      }
+      writer->Append(chain,ndim,nwalkers,step,nSteps,sampler->State());
+    }
+    else {
+      std::string filename = plotfile_name(outFilePrefix,step,nSteps,ndigits);
+      if (ioproc) {
+        std::cout << "Writing plotfile: " << filename << std::endl;
+      }
+      UqPlotfile pf(chain,ndim,nwalkers,step,nSteps,sampler->State());
+      pf.Write(filename);
+    }
+  }
+
+  delete writer;
+  delete sampler;
+
+  BoxLib::Finalize();
+
+#ifdef BL_USE_MPI
+  MPI_Finalize();
+#endif
+}
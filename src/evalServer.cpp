@@ -0,0 +1,65 @@
+#include <Driver.H>
+#include <ChemDriver.H>
+#include <EvalServer.H>
+
+#include <iostream>
+#include <algorithm>
+
+#include <ParmParse.H>
+#include <ParallelDescriptor.H>
+
+static void
+measurements(const double* x, int n, double* data, int* ok)
+{
+  ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  int num_params = Driver::NumParams();
+  int num_data = Driver::NumData();
+  std::vector<Real> dvals(num_data);
+  for (int i=0; i<n; ++i) {
+    const double* p = x + (size_t)i * num_params;
+    ok[i] = expt_manager.GenerateTestMeasurements(std::vector<Real>(p, p + num_params),dvals);
+    std::copy(dvals.begin(),dvals.end(),data + (size_t)i * num_data);
+  }
+}
+
+// Evaluation server: initialize the Driver once, then evaluate the
+// parameter vectors sent by clients (EvalClient, or
+// pyemcee/evalClient.py) on the local socket eval_server.socket,
+// until a client asks for shutdown.  Log likelihoods and measurements
+// are evaluated sample after sample, with the experiments over threads.
+int
+main (int   argc,
+      char* argv[])
+{
+#ifdef BL_USE_MPI
+  MPI_Init (&argc, &argv);
+  Driver driver(argc,argv,1);
+  driver.SetComm(MPI_COMM_WORLD);
+  driver.init(argc,argv);
+#else
+  Driver driver(argc,argv,0);
+#endif
+  driver.SetParallelModeThreaded();
+
+  if (ParallelDescriptor::NProcs() > 1) {
+    BoxLib::Abort("evalServer runs on a single rank");
+  }
+
+  ParmParse pp("eval_server");
+  std::string socket_name = "uq_eval.sock"; pp.query("socket",socket_name);
+
+  {
+    EvalServer server(socket_name,Driver::NumParams(),Driver::NumData(),
+                      Driver::LogLikelihoodBatch,measurements);
+    std::cout << "Serving " << Driver::NumParams() << " parameters, "
+              << Driver::NumData() << " data on " << socket_name << std::endl;
+    server.Run();
+  }
+  std::cout << "Evaluation server stopped" << std::endl;
+
+  BoxLib::Finalize();
+
+#ifdef BL_USE_MPI
+  MPI_Finalize();
+#endif
+}
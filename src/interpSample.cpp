@@ -66,23 +66,25 @@ main (int   argc,
     std::string restartR; pp.get("restartR",restartR);
     UqPlotfile pf;
 
-    pf.Read(restartL);
+    pf.ReadInfo(restartL);
     int iter = pf.ITER() + pf.NITERS() - 1;
     int iters = 1;
     int IDL = iter; pp.query("IDL",IDL);
     if (IDL < pf.ITER() || IDL >= iter+iters) {
       BoxLib::Abort("IDL sample not in restartL");
     }
+    pf.Read(restartL, IDL, iters);
     stateL = pf.LoadEnsemble(IDL, iters);
     BL_ASSERT(stateL.size() == num_params);
 
-    pf.Read(restartR);
+    pf.ReadInfo(restartR);
     iter = pf.ITER() + pf.NITERS() - 1;
     iters = 1;
     int IDR = iter; pp.query("IDR",IDR);
     if (IDR < pf.ITER() || IDR >= iter+iters) {
       BoxLib::Abort("IDR sample not in restartR");
     }
+    pf.Read(restartR, IDR, iters);
     stateR = pf.LoadEnsemble(IDR, iters);
     BL_ASSERT(stateR.size() == num_params);
   }
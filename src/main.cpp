@@ -48,13 +48,14 @@ main (int   argc,
 
     std::string initFile; pp.get("initFile",initFile);
     UqPlotfile pf;
-    pf.Read(initFile);
+    pf.ReadInfo(initFile);
     int iter = pf.ITER() + pf.NITERS() - 1;
     int iters = 1;
     int initID = iter; pp.query("initID",initID);
     if (initID < pf.ITER() || initID >= iter+iters) {
       BoxLib::Abort("InitID sample not in initFile");
     }
+    pf.Read(initFile, initID, iters);
     guess_params = pf.LoadEnsemble(initID, iters);
 
     if (ioproc) {
@@ -169,9 +170,10 @@ main (int   argc,
   if (!do_minimize) {
 
     UqPlotfile pf;
-    pf.Read(samples_at_min_file);
+    pf.ReadInfo(samples_at_min_file);
     int iter = pf.ITER() + pf.NITERS() - 1;
     int iters = 1;
+    pf.Read(samples_at_min_file, iter, iters);
     soln_params = pf.LoadEnsemble(iter, iters);
     ParallelDescriptor::Bcast(&(soln_params[0]),soln_params.size(),ParallelDescriptor::IOProcessorNumber());
 
@@ -209,9 +211,24 @@ main (int   argc,
    */
   int NOS = 10000; pp.query("NOS",NOS);
   std::vector<Real> w(NOS);
-  std::vector<std::vector<Real> > samples(NOS, std::vector<Real>(num_params,-1));
+
+  // Samples are processed in chunks and only the statistics and a
+  // reservoir of resampled samples are kept.  With keep_samples = 1, all
+  // samples are kept as well and written to the mysamples plotfile.
+  int sample_chunk_size = 1024; pp.query("sample_chunk_size",sample_chunk_size);
+  int resample_size = std::min(NOS,100000); pp.query("resample_size",resample_size);
+  bool keep_samples = false; pp.query("keep_samples",keep_samples);
+
+  // Draw the proposals of the prior MC and linear/random map samplers
+  // from scrambled Sobol points, split into qmc_replicates independent
+  // scrambles whose spread gives error bars
+  bool use_qmc = false; pp.query("use_qmc",use_qmc);
+  int qmc_replicates = 1; pp.query("qmc_replicates",qmc_replicates);
 
   bool fd_Hessian = true; pp.query("fd_Hessian",fd_Hessian);
+  int hessian_rank = 0; pp.query("hessian_rank",hessian_rank);
+  int hessian_oversample = 5; pp.query("hessian_oversample",hessian_oversample);
+  bool hessian_verbose = false; pp.query("hessian_verbose",hessian_verbose);
 
   Sampler *sampler = 0;
   if (which_sampler == "prior_mc") {
@@ -232,7 +249,15 @@ main (int   argc,
       hessianIS.close();
     }
     else {
-      if (fd_Hessian) {
+      if (fd_Hessian && hessian_rank > 0) {
+	if (ioproc) {
+	  std::cout << "      Getting rank " << hessian_rank
+                    << " Hessian approximation with finite differences... " << std::endl;
+	}
+        H = Minimizer::LowRank_Hessian((void*)driver.mystruct, soln_params,
+                                       hessian_rank, hessian_oversample, hessian_verbose);
+      }
+      else if (fd_Hessian) {
 	if (ioproc) {
 	  std::cout << "      Getting Hessian with finite differences... " << std::endl;
 	}
@@ -265,7 +290,9 @@ main (int   argc,
     InvSqrtH = Minimizer::InvSqrt((void*)driver.mystruct, H);
 
     if (which_sampler == "linear_map" ||
-        which_sampler == "symmetrized_linear_map") {
+        which_sampler == "symmetrized_linear_map" ||
+        which_sampler == "adaptive_linear_map" ||
+        which_sampler == "random_map") {
 
       // Output value of objective function at minimum
       if (ioproc) {
@@ -279,6 +306,19 @@ main (int   argc,
       if (which_sampler == "linear_map") {
         sampler = new LinearMapSampler(soln_params,H,InvSqrtH,phi);
       }
+      else if (which_sampler == "random_map") {
+        Real rm_tol = 1.e-6; pp.query("rm_tol",rm_tol);
+        int rm_max_iter = 50; pp.query("rm_max_iter",rm_max_iter);
+        sampler = new RandomMapSampler(soln_params,H,InvSqrtH,phi,rm_tol,rm_max_iter);
+      }
+      else if (which_sampler == "adaptive_linear_map") {
+        int ais_round_size = std::min(NOS,1000); pp.query("ais_round_size",ais_round_size);
+        Real ais_target_ess = 0; pp.query("ais_target_ess",ais_target_ess);
+        int ais_max_rounds = 100; pp.query("ais_max_rounds",ais_max_rounds);
+        Real ais_cov_scale = 1; pp.query("ais_cov_scale",ais_cov_scale);
+        sampler = new AdaptiveLinearMapSampler(soln_params,H,InvSqrtH,phi,ais_round_size,
+                                               ais_target_ess,ais_max_rounds,ais_cov_scale);
+      }
       else {
         sampler = new SymmetrizedLinearMapSampler(soln_params,H,InvSqrtH,phi);
       }
@@ -290,28 +330,49 @@ main (int   argc,
     }
   }
 
+  ScrambledSobol* qmc = 0;
+  if (sampler && use_qmc) {
+    if (which_sampler == "adaptive_linear_map") {
+      BoxLib::Abort("use_qmc is not supported by adaptive_linear_map");
+    }
+    qmc_replicates = std::max(1, std::min(qmc_replicates, NOS));
+    int qmc_points = (NOS + qmc_replicates - 1) / qmc_replicates;
+    if (ioproc && (qmc_points & (qmc_points - 1)) != 0) {
+      std::cout << "WARNING: " << qmc_points << " points per QMC replicate;"
+                << " a power of two is better balanced" << std::endl;
+    }
+    qmc = new ScrambledSobol(num_params,qmc_points,qmc_replicates,RandSeed());
+    sampler->SetQMC(qmc);
+  }
+
   if (sampler) {
     if (ioproc) {
       std::cout << "Sampling..." << std::endl;
     }
-    sampler->Sample((void*)(driver.mystruct), samples, w);
+    SampleAccumulator acc(num_params,resample_size);
+    SampleMatrix samples;
+    sampler->Sample((void*)(driver.mystruct), acc, w, sample_chunk_size,
+                    keep_samples ? &samples : 0);
     if (ioproc) {
       std::cout << "...Finished" << std::endl;
     }
-    std::string samples_outfile = "mysamples";
-
-    int len = NOS * num_params;
-    std::vector<double> samplesT(len);
-    for (int i=0; i<NOS; ++i) {
-      for (int j=0; j<num_params; ++j) {
-        int index = i + j*NOS;
-        samplesT[index] = samples[i][j];
-      }
+
+    // Samples are collected on the IO processor
+    if (keep_samples && ioproc) {
+      std::string samples_outfile = "mysamples";
+
+      std::vector<double> samplesT = samples.ParameterMajor();
+      // Samples are generated from per-sample streams, so the next stream
+      // to use is all that is needed to continue this sequence
+      // (adaptive samplers may stop before NOS samples)
+      int nsamples = samples.NumSamples();
+      RandStream rs(RandSeed(),nsamples,RAND_TAG_PROPOSAL);
+      UqPlotfile pf(samplesT,num_params,1,0,nsamples,rs.State());
+      pf.Write(samples_outfile);
     }
-    UqPlotfile pf(samplesT,num_params,1,0,NOS,"");
-    pf.Write(samples_outfile);
   }
   delete sampler;
+  delete qmc;
   delete minimizer;
 
   BoxLib::Finalize();
@@ -14,60 +14,44 @@
 
 #include <ParallelDescriptor.H>
 
-static void GATHER_TO_IO(std::vector<Real>& send_data,
-			 int                 num_send,
-			 std::vector<Real>& recv_data,
-			 int&                num_recv)
+// Position of this rank's num_loc samples in the sequence of samples
+// of all ranks, in rank order, and the total number of samples
+static void SAMPLE_OFFSET(int  num_loc,
+			  int& offset,
+			  int& num_tot)
 {
   int nprocs = ParallelDescriptor::NProcs();
   int myproc = ParallelDescriptor::MyProc();
 
-  std::vector<int> recv_cnts(nprocs,0);
-  std::vector<int> rdispls(nprocs,0);
+  std::vector<int> cnts(nprocs,0);
+  cnts[myproc] = num_loc;
+  ParallelDescriptor::ReduceIntSum(&(cnts[0]),nprocs);
 
-  recv_cnts[ParallelDescriptor::MyProc()] = num_send;
-  ParallelDescriptor::ReduceIntSum(&(recv_cnts[0]),nprocs);
-
-  num_recv = 0;
-  if (ParallelDescriptor::IOProcessor()) {
-    for (int i=0; i<nprocs; ++i) {
-      num_recv += recv_cnts[i];
-      if (i == 0) {
-	rdispls[0] = 0;
-      }
-      else {
-	rdispls[i] = rdispls[i-1] + recv_cnts[i-1];
-      }
+  offset = 0;
+  num_tot = 0;
+  for (int i=0; i<nprocs; ++i) {
+    if (i < myproc) {
+      offset += cnts[i];
     }
-    recv_data.resize(num_recv);
+    num_tot += cnts[i];
   }
-#if BL_USE_MPI
-  BL_MPI_REQUIRE( MPI_Gatherv(num_send == 0 ? 0 : &(send_data[0]),
-			      num_send,
-			      ParallelDescriptor::Mpi_typemap<Real>::type(),
-			      num_recv == 0 ? 0 : &(recv_data[0]),
-			      &(recv_cnts[0]),
-			      &(rdispls[0]),
-			      ParallelDescriptor::Mpi_typemap<Real>::type(),
-			      ParallelDescriptor::IOProcessorNumber(),
-			      ParallelDescriptor::Communicator()) );
-#endif
 }
 
 std::vector<Real>
 GetBoundedSample(const std::vector<Real>& prior_mean,
 		 const std::vector<Real>& prior_std,
 		 const std::vector<Real>& upper_bound,
-		 const std::vector<Real>& lower_bound)
+		 const std::vector<Real>& lower_bound,
+		 RandStream&              rs)
 {
   int N = prior_mean.size();
   std::vector<Real> sample(N);
   for (int i=0; i<N; ++i) {
-    Real r = 2*(BoxLib::Random() - 0.5);
+    Real r = 2*(rs.drand() - 0.5);
     sample[i] = prior_mean[i] + prior_std[i]*r;
     bool sample_oob = (sample[i] < lower_bound[i] || sample[i] > upper_bound[i]);	
     while (sample_oob) {
-      sample[i] = prior_mean[i] + prior_std[i]*BoxLib::Random();
+      sample[i] = prior_mean[i] + prior_std[i]*rs.drand();
       sample_oob = (sample[i] < lower_bound[i] || sample[i] > upper_bound[i]);
     }
   }
@@ -135,8 +119,11 @@ main (int   argc,
   {
     bool ok = false;
     std::vector<Real> thisSample(num_params);
+
+    // Each (rank, sample) pair has its own random stream
+    RandStream rs(RandSeed(), (uint64_t)j*nprocs + myproc, RAND_TAG_PROPOSAL);
     while (ok == false && num_failures<max_failures) {
-      thisSample = GetBoundedSample(prior_mean, ensemble_std, upper_bound, lower_bound);
+      thisSample = GetBoundedSample(prior_mean, ensemble_std, upper_bound, lower_bound, rs);
       ok = minimizer->minimize((void*)(driver.mystruct), thisSample, thisSolns);
       if (!ok) {
 	num_failures++;
@@ -166,76 +153,30 @@ main (int   argc,
   }
   int NOSloc = j;
 
-  std::vector<Real> samplesg;
-  std::vector<Real> solnsg;
-  int num_send = num_params * NOSloc;
-  int num_recv = num_send;
-
-  GATHER_TO_IO(  solns, num_send, solnsg,   num_recv); solns.clear();
-  GATHER_TO_IO(samples, num_send, samplesg, num_recv); samples.clear();
-
-  std::vector<Real> Fg;
-  int num_send_F = NOSloc;
-  int num_recv_F = num_send;
-  GATHER_TO_IO(F, num_send_F, Fg, num_recv_F); F.clear();
-
-  std::vector<Real> hessiansg;
-  int num_send_h, num_recv_h;
-  if (hasHessian) {
-    num_send_h = num_params * num_params * NOSloc;
-    num_recv_h = num_send_h;
-    GATHER_TO_IO(hessians, num_send_h, hessiansg, num_recv_h); hessians.clear();
-  }
-
   std::string samples_file = "samples"; pp.query("samples",samples_file);
   std::string solns_file = "solns"; pp.query("solns",solns_file);
   std::string Fs_file = "Fs"; pp.query("Fs",Fs_file);
   std::string hessians_file = "hessians"; pp.query("hessians",hessians_file);
 
-  if (myproc == 0) {
+  // Each sample is an iteration of a single walker, so the samples of
+  // a rank, stored sample after sample, are a block of iterations in
+  // chunk order, written in place by every rank
+  int NOSoffset, NOStot;
+  SAMPLE_OFFSET(NOSloc, NOSoffset, NOStot);
 
-    int NOStot = num_recv / num_params;
-    BL_ASSERT(NOStot * num_params == num_recv);
+  UqPlotfile::WriteDistributed(samples_file,samples,num_params,1,0,NOStot,0,1,NOSoffset,NOSloc,"");
+  samples.clear();
 
-    // Transpose sample data to be compatible with pltfile format
-    std::vector<Real> samplesT(num_params * NOStot);
-    std::vector<Real> solnsT(num_params * NOStot);
-    for (int k=0; k<NOStot; ++k) {	
-      for (int i=0; i<num_params; ++i) {
-	samplesT[k + i*NOStot] = samplesg[i + k*num_params];
-	solnsT[  k + i*NOStot] = solnsg[  i + k*num_params];
-      }
-    }
-    samplesg.clear();
-    solnsg.clear();
+  UqPlotfile::WriteDistributed(solns_file,solns,num_params,1,0,NOStot,0,1,NOSoffset,NOSloc,"");
+  solns.clear();
 
-    UqPlotfile pfi(samplesT,num_params,1,0,NOStot,"");
-    pfi.Write(samples_file);
-    samplesT.clear();
+  UqPlotfile::WriteDistributed(Fs_file,F,1,1,0,NOStot,0,1,NOSoffset,NOSloc,"");
+  F.clear();
 
-    UqPlotfile pfo(solnsT,num_params,1,0,NOStot,"");
-    pfo.Write(solns_file);
-    solnsT.clear();
-
-    UqPlotfile pff(Fg,1,1,0,NOStot,"");
-    pff.Write(Fs_file);
-    Fg.clear();
-
-    if (hasHessian) {
-      std::vector<Real> hessiansT(num_params * num_params * NOStot);
-      for (int j=0; j<NOStot; ++j) {
-	for (int i=0; i<num_params; ++i) {
-	  for (int k=0; k<num_params; ++k) {
-	    hessiansT[NOStot*(i*num_params + k) + j] = hessiansg[j*num_params*num_params + i*num_params + k];
-	  }
-	}
-      }
-      hessiansg.clear();
-
-      UqPlotfile pfH(hessiansT,num_params*num_params,1,0,NOStot,"");
-      pfH.Write(hessians_file);
-      hessiansT.clear();
-    }
+  if (hasHessian) {
+    UqPlotfile::WriteDistributed(hessians_file,hessians,num_params*num_params,1,0,NOStot,
+				 0,1,NOSoffset,NOSloc,"");
+    hessians.clear();
   }
 
   delete minimizer;
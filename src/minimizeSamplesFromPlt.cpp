@@ -57,7 +57,7 @@ main (int   argc,
 
   std::string initFile; pp.get("initFile",initFile);
   UqPlotfile pf;
-  pf.Read(initFile);
+  pf.ReadInfo(initFile);
   int iter = pf.ITER();
   int iters = pf.NITERS();
   int nwalkers = pf.NWALKERS();
@@ -65,6 +65,7 @@ main (int   argc,
 
   pp.query("iter",iter);
   pp.query("iters",iters);
+  pf.Read(initFile,iter,iters);
   int walker = 0;
   pp.query("walker",walker);
 
@@ -53,6 +53,29 @@ namespace std {
   %template(StringVec) std::vector<std::string>;
 };
 
+%pythoncode %{
+import numpy as np
+%}
+
+/* NumPy interfaces.  Input arrays that are C-contiguous float64 are
+   used in place, output arrays are allocated by NumPy and filled by
+   the C++ code, and the GIL is released while it runs.
+
+   >>> logL = pyemcee.Driver.LogLikelihoodArray(x)  # x[nsamples,nparams]
+   >>> pf = pyemcee.UqPlotfile(sampler.chain, step, rstate)
+   >>> chain = pf.LoadChain(iter, iters)            # [nwalkers,iters,ndim]
+ */
+%apply (double* IN_ARRAY2, int DIM1, int DIM2) {(double* parameters, int nsamples, int nparams)};
+%apply (double* IN_ARRAY1, int DIM1) {(double* params, int nparams)};
+%apply (double* ARGOUT_ARRAY1, int DIM1) {(double* result, int nresult)};
+%apply (double* IN_ARRAY3, int DIM1, int DIM2, int DIM3) {(double* chain, int nwalkers, int iters, int ndim)};
+
+/* Raise the Python error set by the array functions on bad sizes */
+%exception Driver::_GenerateTestMeasurementsArray {
+  $action
+  if (PyErr_Occurred()) SWIG_fail;
+}
+
 struct Driver
 {
   Driver(int argc, char**argv, int mpi_later);
@@ -75,6 +98,53 @@ struct Driver
   static std::vector<double> MeasuredDataSTD();
   static std::vector<double> MeasuredData();
   static std::vector<double> TrueParameters();
+  static std::vector<std::string> ExperimentNames();
+  static std::vector<std::string> ExperimentCounterNames();
+  static std::vector<double> ExperimentCounters(const std::string& counter);
+  static std::vector<double> ExperimentFailures(const std::string& error);
+  static void ResetExperimentCounters();
+  static void WriteExperimentProfile();
+
+  %extend {
+    static void _LogLikelihoodArray(double* parameters, int nsamples, int nparams,
+                                    double* result, int nresult) {
+      Py_BEGIN_ALLOW_THREADS
+      Driver::LogLikelihoodBatch(parameters,nsamples,result);
+      Py_END_ALLOW_THREADS
+    }
+
+    static void _GenerateTestMeasurementsArray(double* params, int nparams,
+                                               double* result, int nresult) {
+      std::vector<double> p(params,params+nparams), d;
+      Py_BEGIN_ALLOW_THREADS
+      d = Driver::GenerateTestMeasurements(p);
+      Py_END_ALLOW_THREADS
+      if (d.size() != nresult) {
+        PyErr_Format(PyExc_ValueError,"expected %d simulated data, got %d",
+                     nresult,(int)d.size());
+        return;
+      }
+      std::copy(d.begin(),d.end(),result);
+    }
+
+    %pythoncode %{
+    @staticmethod
+    def LogLikelihoodArray(parameters):
+        """Log likelihoods of the rows of parameters"""
+        x = np.ascontiguousarray(parameters, dtype=np.float64)
+        if x.ndim != 2 or x.shape[1] != Driver.NumParams():
+            raise ValueError('parameters must be an array [nsamples, NumParams()]')
+        return Driver._LogLikelihoodArray(x, x.shape[0])
+
+    @staticmethod
+    def GenerateTestMeasurementsArray(parameters):
+        """Simulated data at parameters, as an array of NumData() values"""
+        x = np.ascontiguousarray(parameters, dtype=np.float64)
+        if x.ndim != 1 or x.shape[0] != Driver.NumParams():
+            raise ValueError('parameters must be an array of NumParams() values')
+        return Driver._GenerateTestMeasurementsArray(x, Driver.NumData())
+    %}
+  }
 };
 
 /* Here, we expose the BoxLib::ParmParse class, but only for strings, lists of strings
@@ -117,4 +187,45 @@ struct ParmParse
   }
 };
 
+%ignore UqPlotfile::UqPlotfile(const double*, int, int, int, int, const std::string&);
+%ignore UqPlotfile::LoadChain;
+%ignore UqPlotfileWriter::AppendChain(const double*, int, int, int, int, const std::string&);
+
 %include <UqPlotfile.H>
+
+%extend UqPlotfile {
+  // chain[nwalkers,iters,ndim], as sampler.chain of emcee
+  UqPlotfile(double* chain, int nwalkers, int iters, int ndim,
+             int iter, const std::string& rng_state) {
+    UqPlotfile* pf;
+    Py_BEGIN_ALLOW_THREADS
+    pf = new UqPlotfile(chain,nwalkers,iters,ndim,iter,rng_state);
+    Py_END_ALLOW_THREADS
+    return pf;
+  }
+
+  void _LoadChain(int iter, int iters, double* result, int nresult) {
+    Py_BEGIN_ALLOW_THREADS
+    self->LoadChain(iter,iters,result);
+    Py_END_ALLOW_THREADS
+  }
+
+  %pythoncode %{
+  def LoadChain(self, iter, iters):
+      """Iterations [iter, iter+iters) as an array [nwalkers, iters, ndim]"""
+      if iter < self.ITER() or iter + iters > self.ITER() + self.NITERS():
+          raise ValueError('iterations not in plotfile')
+      n = self.NWALKERS() * iters * self.NDIM()
+      return self._LoadChain(iter, iters, n).reshape(self.NWALKERS(), iters, self.NDIM())
+  %}
+}
+
+%extend UqPlotfileWriter {
+  // chain[nwalkers,iters,ndim], as sampler.chain of emcee
+  void AppendChain(double* chain, int nwalkers, int iters, int ndim,
+                   int iter, const std::string& rng_state) {
+    Py_BEGIN_ALLOW_THREADS
+    self->AppendChain(chain,nwalkers,iters,ndim,iter,rng_state);
+    Py_END_ALLOW_THREADS
+  }
+}
@@ -51,7 +51,7 @@ def LoadPlotfile(driver,filename):
         print('Loading plotfile: '+filename)
         
     pf = pymc.UqPlotfile()
-    pf.Read(filename)
+    pf.ReadInfo(filename)
     t_nwalkers = pf.NWALKERS()
     t_ndim = pf.NDIM()
     t_iters = 1
@@ -59,6 +59,7 @@ def LoadPlotfile(driver,filename):
     rstate = cPickle.loads(pf.RSTATE())
     iter = pf.ITER() + pf.NITERS() - 1
 
+    pf.Read(filename, iter, t_iters)
     p0 = pf.LoadEnsemble(iter,t_iters)
 
     ret = []
@@ -34,30 +34,33 @@ def WritePlotfile(driver, outFilePrefix, nwalkers,
 
     fmt = "%0"+str(nDigits)+"d"
     lastStep = step + nSteps - 1
-    filename = outFilePrefix + '_' + (fmt % step) + '_' + (fmt % lastStep)
+    if outFileAppend:
+        filename = outFilePrefix
+    else:
+        filename = outFilePrefix + '_' + (fmt % step) + '_' + (fmt % lastStep)
 
     if rank == 0:
-        print('Writing plotfile: '+filename)
-
-    x = driver.sampler.chain
-
-    ndim = driver.NumParams()
-    C_array_size = nSteps*ndim*nwalkers
-    x_for_c = pymc.DoubleVec(C_array_size)
+        if outFileAppend:
+            print('Appending steps ' + str(step) + ' to ' + str(lastStep)
+                  + ' to plotfile: ' + filename)
+        else:
+            print('Writing plotfile: '+filename)
 
-    for walker in range(0, nwalkers):
-        for it in range(0, nSteps):
-            for dim in range(0, ndim):
-                index = walker + nwalkers*it + nwalkers*nSteps*dim
-                x_for_c[index] = x[walker, it, dim]
+    # [nwalkers, nSteps, ndim]; the slice is not contiguous unless
+    # nSteps covers the whole chain, so this makes the one copy
+    x = np.ascontiguousarray(driver.sampler.chain[:, :nSteps, :], dtype=np.float64)
 
     if rstate is None:
         rstateString = ''
     else:
         rstateString = cPickle.dumps(rstate)
 
-    pf = pymc.UqPlotfile(x_for_c, ndim, nwalkers, step, nSteps, rstateString)
-    pf.Write(filename)
+    if outFileAppend:
+        # Written in the background by the C++ writer thread
+        writer.AppendChain(x, step, rstateString)
+    else:
+        pf = pymc.UqPlotfile(x, step, rstateString)
+        pf.Write(filename)
 
     if rank == 0:
         flog=open('plotfiles.log', 'a')
@@ -70,9 +73,7 @@ def LoadPlotfile(driver,filename):
         print('Loading plotfile: '+filename)
 
     pf = pymc.UqPlotfile()
-    pf.Read_serial(filename)
-    if rank == 0:
-        print('Done Loading plotfile: '+filename)
+    pf.ReadInfo(filename)
     t_nwalkers = pf.NWALKERS()
     t_ndim = pf.NDIM()
     t_iters = 1
@@ -80,13 +81,13 @@ def LoadPlotfile(driver,filename):
     rstate = cPickle.loads(pf.RSTATE())
     iter = pf.ITER() + pf.NITERS() - 1
 
-    p0 = pf.LoadEnsemble(iter, t_iters)
+    pf.Read_serial(filename, iter, t_iters)
+    if rank == 0:
+        print('Done Loading plotfile: '+filename)
 
-    ret = []
-    for walker in range(0, t_nwalkers):
-        ret.append(np.zeros(t_ndim))
-        for dim in range(0, t_ndim):
-            ret[walker][dim] = p0[walker + t_nwalkers*dim]
+    p0 = pf.LoadChain(iter, t_iters)
+
+    ret = list(p0[:, 0, :])
 
     return ret, iter, rstate
 
@@ -201,6 +202,9 @@ outFilePeriod = int(pp['outFilePeriod'])
 seed = int(pp['seed'])
 restartFile = pp['restartFile']
 emcee_stepsize = float(pp['emcee_stepsize'])
+outFileAppend = pp['outFileAppend'] == '1'
+if outFileAppend:
+    writer = pymc.UqPlotfileWriter(outFilePrefix)
 
 if rank == 0:
     print('     nwalkers: ', nwalkers)
@@ -209,6 +213,7 @@ if rank == 0:
     print('outFilePeriod: ', outFilePeriod)
     print('         seed: ', seed)
     print('  restartFile: ', restartFile)
+    print('outFileAppend: ', outFileAppend)
     print('')
 
     print('Number of Parameters:', ndim)
@@ -284,6 +289,9 @@ def do_sampler():
     
         step = step + nSteps
 
+    if outFileAppend:
+        writer.Flush()
+
 # Build a sampler object
 
 if parallel_mode == 'HYBRID':
@@ -40,7 +40,7 @@ def LoadPlotfile(filename):
         print('Loading plotfile: '+filename)
         
     pf = pymc.UqPlotfile()
-    pf.Read(filename)
+    pf.ReadInfo(filename)
     t_nwalkers = pf.NWALKERS()
     t_ndim = pf.NDIM()
     t_iters = 1
@@ -48,6 +48,7 @@ def LoadPlotfile(filename):
     rstate = cPickle.loads(pf.RSTATE())
     iter = pf.ITER() + pf.NITERS() - 1
 
+    pf.Read(filename, iter, t_iters)
     p0 = pf.LoadEnsemble(iter,t_iters)
 
     ret = []
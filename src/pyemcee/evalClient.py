@@ -0,0 +1,85 @@
+# Client of the evaluation server (evalServer.cpp, EvalServer.H), for
+# samplers that share one initialized Driver on a node instead of
+# importing pyemcee.  Does not need the compiled module.
+#
+#   client = EvalClient('uq_eval.sock')
+#   lnprob = client.LogLikelihood(x)            # x: [nsamples, nparams]
+#   data, ok = client.GenerateTestMeasurements(x)
+
+import socket
+import struct
+import numpy as np
+
+EVAL_INFO = 0
+EVAL_LOGLIKELIHOOD = 1
+EVAL_MEASUREMENTS = 2
+EVAL_SHUTDOWN = 3
+
+class EvalClient:
+
+    def __init__(self, socket_name):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(socket_name)
+        self.nparams = -1
+        self._send(EVAL_INFO, np.zeros((0, 0)))
+        self._status()
+        self.nparams, self.ndata = struct.unpack('=ii', self._recv(8))
+
+    def NumParams(self):
+        return self.nparams
+
+    def NumData(self):
+        return self.ndata
+
+    # Log likelihoods of the rows of x, as Driver.LogLikelihood
+    # (positive for failed samples)
+    def LogLikelihood(self, x):
+        x = self._samples(x)
+        self._send(EVAL_LOGLIKELIHOOD, x)
+        self._status()
+        return np.frombuffer(self._recv(8*len(x)), dtype=np.float64).copy()
+
+    # Measurements at the rows of x, [nsamples, ndata], and whether
+    # the experiments succeeded for each row
+    def GenerateTestMeasurements(self, x):
+        x = self._samples(x)
+        n = len(x)
+        self._send(EVAL_MEASUREMENTS, x)
+        self._status()
+        ok = np.frombuffer(self._recv(4*n), dtype=np.int32) != 0
+        data = np.frombuffer(self._recv(8*n*self.ndata), dtype=np.float64)
+        return data.reshape(n, self.ndata).copy(), ok
+
+    # Stop the server once the queued requests are done
+    def Shutdown(self):
+        self._send(EVAL_SHUTDOWN, np.zeros((0, 0)))
+        self._status()
+
+    def close(self):
+        self.sock.close()
+
+    def _samples(self, x):
+        x = np.ascontiguousarray(x, dtype=np.float64)
+        if x.ndim == 1:
+            x = x.reshape(1, -1)
+        if x.ndim != 2 or x.shape[1] != self.nparams:
+            raise ValueError('samples must have shape [nsamples, %d]' % self.nparams)
+        return x
+
+    def _send(self, op, x):
+        self.sock.sendall(struct.pack('=iii', op, len(x), self.nparams) + x.tobytes())
+
+    def _status(self):
+        status, = struct.unpack('=i', self._recv(4))
+        if status != 0:
+            raise RuntimeError('request refused by the evaluation server')
+
+    def _recv(self, nbytes):
+        chunks = []
+        while nbytes > 0:
+            chunk = self.sock.recv(nbytes)
+            if not chunk:
+                raise RuntimeError('connection to the evaluation server lost')
+            chunks.append(chunk)
+            nbytes -= len(chunk)
+        return b''.join(chunks)
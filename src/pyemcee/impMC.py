@@ -25,21 +25,16 @@ def WritePlotfile(samples,ndim,outFilePrefix,nwalkers,step,nSteps,nDigits,rstate
 
         print('Writing plotfile: '+filename)
         
-        C_array_size = nSteps*ndim*nwalkers
-        x_for_c = pymc.DoubleVec(C_array_size)
-
-        for walker in range(0,nwalkers):
-            for it in range(0,nSteps):
-                for dim in range(0,ndim):
-                    index = walker + nwalkers*it + nwalkers*nSteps*dim
-                    x_for_c[index] = samples[dim,step+it]
+        # Every walker holds the samples, as [nwalkers, nSteps, ndim]
+        x = np.empty((nwalkers, nSteps, ndim))
+        x[:] = samples[:, step:step+nSteps].T
 
         if rstate == None:
             rstateString = ''
         else:
             rstateString = cPickle.dumps(rstate)
 
-        pf = pymc.UqPlotfile(x_for_c, ndim, nwalkers, step, nSteps, rstateString)
+        pf = pymc.UqPlotfile(x, step, rstateString)
         pf.Write(filename)
 
 def LoadPlotfile(filename):
@@ -54,15 +49,9 @@ def LoadPlotfile(filename):
     iters = pf.NITERS()
     iter = pf.ITER()
 
-    p0 = pf.LoadEnsemble(iter,iters)
+    p0 = pf.LoadChain(iter,iters)
 
-    ret = []
-    for walker in range(0,nwalkers):
-        for it in range(0,iters):
-            ret.append(np.zeros(ndim))
-            for dim in range(0,ndim):
-                index = walker + nwalkers*it + nwalkers*iters*dim
-                ret[-1][dim] = p0[index]
+    ret = list(p0.reshape(nwalkers*iters, ndim))
 
     return ret
 
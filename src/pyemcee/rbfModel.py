@@ -17,21 +17,16 @@ def WritePlotfile(samples,ndim,outFilePrefix,nwalkers,step,nSteps,nDigits,rstate
 
         print('Writing plotfile: '+filename)
         
-        C_array_size = nSteps*ndim*nwalkers
-        x_for_c = pymc.DoubleVec(C_array_size)
-
-        for walker in range(0,nwalkers):
-            for it in range(0,nSteps):
-                for dim in range(0,ndim):
-                    index = walker + nwalkers*it + nwalkers*nSteps*dim
-                    x_for_c[index] = samples[dim,it]
+        # Every walker holds the samples, as [nwalkers, nSteps, ndim]
+        x = np.empty((nwalkers, nSteps, ndim))
+        x[:] = samples[:, :nSteps].T
 
         if rstate == None:
             rstateString = ''
         else:
             rstateString = cPickle.dumps(rstate)
 
-        pf = pymc.UqPlotfile(x_for_c, ndim, nwalkers, step, nSteps, rstateString)
+        pf = pymc.UqPlotfile(x, step, rstateString)
         pf.Write(filename)
 
 def LoadPlotfile(filename):
@@ -40,7 +35,7 @@ def LoadPlotfile(filename):
         print('Loading plotfile: '+filename)
         
     pf = pymc.UqPlotfile()
-    pf.Read(filename)
+    pf.ReadInfo(filename)
     t_nwalkers = pf.NWALKERS()
     t_ndim = pf.NDIM()
     t_iters = 1
@@ -48,13 +43,10 @@ def LoadPlotfile(filename):
     rstate = cPickle.loads(pf.RSTATE())
     iter = pf.ITER() + pf.NITERS() - 1
 
-    p0 = pf.LoadEnsemble(iter,t_iters)
+    pf.Read(filename, iter, t_iters)
+    p0 = pf.LoadChain(iter,t_iters)
 
-    ret = []
-    for walker in range(0,t_nwalkers):
-        ret.append(np.zeros(t_ndim))
-        for dim in range(0,t_ndim):
-            ret[walker][dim] = p0[walker + t_nwalkers*dim]
+    ret = list(p0[:, 0, :])
 
     return ret, iter, rstate
 
@@ -0,0 +1,435 @@
+#include <Driver.H>
+#include <ChemDriver.H>
+#include <Rand.H>
+#include <Sobol.H>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#include <ParmParse.H>
+#include <ParallelDescriptor.H>
+#include <ParallelGroups.H>
+
+// Screening outputs of a parameter vector: the misfit
+// sum ((d - data)/std)^2 / 2 of the data of each experiment, and last
+// their sum, the negative log likelihood without the prior
+static int num_outputs;
+
+// Parameter vectors of the points, in the screening box
+static std::vector<Real> box_lo, box_hi;
+
+static void
+to_box(const Real* u, Real* x)
+{
+  for (int i=0; i<box_lo.size(); ++i) {
+    x[i] = box_lo[i] + u[i] * (box_hi[i] - box_lo[i]);
+  }
+}
+
+// Outputs of n points, given in the unit cube one after the other in
+// u, evaluated batch_size at a time over the groups of ranks, the
+// experiments of each point over the threads or the ranks of its group
+// (collective).  ok[s] is 0 for the points whose evaluation failed.
+static void
+evaluate(const std::vector<Real>& u, int n, int batch_size,
+         std::vector<Real>& f, std::vector<int>& ok)
+{
+  ExperimentManager& expt_manager = Driver::mystruct->expt_manager;
+  int num_params = box_lo.size();
+  int num_expts = expt_manager.size();
+  const std::vector<Real>& data = expt_manager.TrueDataWithObservationNoise();
+  const std::vector<Real>& data_std = expt_manager.ObservationSTD();
+  f.resize((size_t)n * num_outputs);
+  ok.resize(n);
+
+  std::vector<Real> x, d;
+  std::vector<int> good;
+  for (int begin=0; begin<n; begin+=batch_size) {
+    int nb = std::min(batch_size, n - begin);
+    x.resize((size_t)nb * num_params);
+    for (int s=0; s<nb; ++s) {
+      to_box(&(u[(size_t)(begin+s)*num_params]), &(x[(size_t)s*num_params]));
+    }
+    expt_manager.GenerateTestMeasurementsBatch(x,nb,d,good);
+
+    int num_dvals = expt_manager.NumExptData();
+    for (int s=0; s<nb; ++s) {
+      Real* fs = &(f[(size_t)(begin+s)*num_outputs]);
+      const Real* ds = &(d[(size_t)s*num_dvals]);
+      Real total = 0;
+      int id = 0;
+      for (int e=0; e<num_expts; ++e) {
+        Real misfit = 0;
+        for (int j=0; j<expt_manager.Experiment(e).NumMeasuredValues(); ++j, ++id) {
+          Real r = (ds[id] - data[id]) / data_std[id];
+          misfit += 0.5 * r * r;
+        }
+        fs[e] = misfit;
+        total += misfit;
+      }
+      fs[num_expts] = total;
+      ok[begin+s] = good[s];
+    }
+    if (ParallelDescriptor::IOProcessor()) {
+      std::cout << "Evaluated " << begin + nb << " of " << n << " points" << std::endl;
+    }
+  }
+}
+
+// Morris elementary effects from r random one-at-a-time trajectories
+// on a grid of p levels, each P+1 points with steps of delta =
+// p/(2(p-1)) of the range.  Per parameter and output: mu* (mean
+// absolute effect), mu (mean effect), sigma (std of the effects), and
+// the number of effects, rows of meas (4 per output).  Effects with a
+// failed end are left out.
+static void
+morris(int r, int p, int batch_size, std::vector<Real>& meas, int& failed)
+{
+  int num_params = box_lo.size();
+  int npts = r * (num_params + 1);
+  Real delta = p / (2.0 * (p - 1));
+  std::vector<Real> u((size_t)npts * num_params);
+  std::vector<int> order((size_t)r * num_params);
+  std::vector<Real> step((size_t)r * num_params);
+  for (int t=0; t<r; ++t) {
+    RandStream rs(RandSeed(),t,RAND_TAG_SCREEN);
+    Real* x = &(u[(size_t)t*(num_params+1)*num_params]);
+    int* perm = &(order[(size_t)t*num_params]);
+    for (int i=0; i<num_params; ++i) {
+      int level = std::min(int(rs.drand() * p), p - 1);
+      x[i] = Real(level) / (p - 1);
+      step[(size_t)t*num_params + i] = (x[i] + delta <= 1 ? delta : -delta);
+      perm[i] = i;
+    }
+    for (int i=num_params-1; i>0; --i) {
+      int j = std::min(int(rs.drand() * (i + 1)), i);
+      std::swap(perm[i],perm[j]);
+    }
+    for (int k=0; k<num_params; ++k) {
+      Real* xk = x + (size_t)(k+1)*num_params;
+      std::copy(xk - num_params, xk, xk);
+      xk[perm[k]] += step[(size_t)t*num_params + perm[k]];
+    }
+  }
+
+  std::vector<Real> f;
+  std::vector<int> ok;
+  evaluate(u,npts,batch_size,f,ok);
+  failed = npts - std::count(ok.begin(),ok.end(),1);
+
+  meas.assign((size_t)num_params * 4 * num_outputs, 0);
+  for (int t=0; t<r; ++t) {
+    for (int k=0; k<num_params; ++k) {
+      int s = t*(num_params+1) + k;
+      if (!ok[s] || !ok[s+1]) {
+        continue;
+      }
+      int i = order[(size_t)t*num_params + k];
+      for (int q=0; q<num_outputs; ++q) {
+        Real ee = (f[(size_t)(s+1)*num_outputs + q] - f[(size_t)s*num_outputs + q])
+          / step[(size_t)t*num_params + i];
+        Real* m = &(meas[((size_t)i*num_outputs + q)*4]);
+        m[0] += std::abs(ee);
+        m[1] += ee;
+        m[2] += ee * ee;
+        m[3] += 1;
+      }
+    }
+  }
+  for (int n=0; n<num_params*num_outputs; ++n) {
+    Real* m = &(meas[(size_t)n*4]);
+    if (m[3] > 0) {
+      m[0] /= m[3];
+      m[1] /= m[3];
+      m[2] = (m[3] > 1 ? std::sqrt(std::max(Real(0), (m[2] - m[3]*m[1]*m[1]) / (m[3] - 1))) : 0);
+    }
+  }
+}
+
+// Saltelli's scheme for Sobol indices: N scrambled Sobol points of
+// dimension 2P give the matrices A and B, and A with column i from B
+// gives AB_i, N(P+2) points in all.  Per parameter and output: total
+// index (Jansen), first order index (Saltelli 2010), and the number of
+// samples used, rows of meas (4 per output, the last unused).  Samples
+// with a failed evaluation are left out.
+static void
+sobol(int N, int batch_size, std::vector<Real>& meas, int& failed)
+{
+  int num_params = box_lo.size();
+  if (2*num_params > ScrambledSobol::MaxDim()) {
+    BoxLib::Abort("screenParams: too many parameters for the Sobol method");
+  }
+  ScrambledSobol qmc(2*num_params,N,1,RandSeed());
+  int npts = N * (num_params + 2);
+  // Point of A, B, AB_0, ..., AB_{P-1} for sample s
+  std::vector<Real> u((size_t)npts * num_params), ab(2*num_params);
+  for (int s=0; s<N; ++s) {
+    qmc.Uniform(s,&(ab[0]));
+    Real* x = &(u[(size_t)s*(num_params+2)*num_params]);
+    std::copy(ab.begin(), ab.begin() + num_params, x);
+    std::copy(ab.begin() + num_params, ab.end(), x + num_params);
+    for (int i=0; i<num_params; ++i) {
+      Real* xi = x + (size_t)(i+2)*num_params;
+      std::copy(ab.begin(), ab.begin() + num_params, xi);
+      xi[i] = ab[num_params + i];
+    }
+  }
+
+  std::vector<Real> f;
+  std::vector<int> ok;
+  evaluate(u,npts,batch_size,f,ok);
+  failed = npts - std::count(ok.begin(),ok.end(),1);
+
+  meas.assign((size_t)num_params * 4 * num_outputs, 0);
+  for (int q=0; q<num_outputs; ++q) {
+    // Variance of the output over the points of A and B
+    Real sum = 0, sum2 = 0;
+    int cnt = 0;
+    for (int s=0; s<N; ++s) {
+      for (int m=0; m<2; ++m) {
+        int pt = s*(num_params+2) + m;
+        if (ok[pt]) {
+          Real v = f[(size_t)pt*num_outputs + q];
+          sum += v;
+          sum2 += v * v;
+          cnt++;
+        }
+      }
+    }
+    Real var = (cnt > 1 ? (sum2 - sum*sum/cnt) / (cnt - 1) : 0);
+    for (int i=0; i<num_params; ++i) {
+      Real* m = &(meas[((size_t)i*num_outputs + q)*4]);
+      for (int s=0; s<N; ++s) {
+        int a = s*(num_params+2);
+        if (!ok[a] || !ok[a+1] || !ok[a+2+i]) {
+          continue;
+        }
+        Real fA = f[(size_t)a*num_outputs + q];
+        Real fB = f[(size_t)(a+1)*num_outputs + q];
+        Real fAB = f[(size_t)(a+2+i)*num_outputs + q];
+        m[0] += 0.5 * (fA - fAB) * (fA - fAB);
+        m[1] += fB * (fAB - fA);
+        m[2] += 1;
+      }
+      if (m[2] > 0 && var > 0) {
+        m[0] /= m[2] * var;
+        m[1] /= m[2] * var;
+      }
+      else {
+        m[0] = m[1] = 0;
+      }
+    }
+  }
+}
+
+// Global sensitivity screening of the active parameters of the inputs
+// file against each experiment, to find the parameters that can be
+// left out of sampling.  The parameters vary over a box: the prior
+// mean plus or minus screen.width (default 2) prior std, within the
+// bounds.  The output of each experiment is the misfit of its data,
+// sum ((d - data)/std)^2 / 2, and the total is the sum over the
+// experiments.
+//
+// With screen.valid_box = 1, the box is first cut down to where all
+// the simulated data are valid, by ExperimentManager::get_param_limits
+// from the prior mean toward each face of the box, to within
+// screen.valid_tol (default 1e-3) of the box width.  Its k-section
+// places screen.valid_points (default: one per group) points in every
+// open bracket per round, so it only beats bisection with groups.
+//
+// screen.method = morris (default): Morris elementary effects of
+//   screen.trajectories (default 10) trajectories on a grid of
+//   screen.levels (default 4) levels, (P+1) evaluations each.
+//   Parameters are ranked by mu* of the total.
+// screen.method = sobol: Sobol total and first order indices from
+//   screen.samples (default 64, best a power of two) samples of
+//   Saltelli's scheme, (P+2) evaluations each.  Parameters are ranked
+//   by the total index of the total.
+//
+// The evaluations go in batches of screen.batch_size (default 256)
+// points, each spread over the groups of group_size ranks (default 1);
+// a group evaluates its points in turn, the experiments of each over
+// threads (group_size 1) or over the ranks of the group.  The ranked
+// table goes to screen.out_file (default screen.dat), one line per
+// parameter after comment lines starting with #, with the measure of
+// each experiment after the total:
+//   morris: rank param mu_star mu sigma effects relative mu_star_<expt>...
+//   sobol:  rank param S_total S_first samples relative S_total_<expt>...
+// where relative is the ranking measure over the largest one.
+int
+main (int   argc,
+      char* argv[])
+{
+#ifdef BL_USE_MPI
+  MPI_Init (&argc, &argv);
+  Driver driver(argc,argv,1);
+  driver.SetComm(MPI_COMM_WORLD);
+  driver.init(argc,argv);
+#else
+  Driver driver(argc,argv,0);
+#endif
+
+  bool ioproc = ParallelDescriptor::IOProcessor();
+
+  ParameterManager& parameter_manager = driver.mystruct->parameter_manager;
+  ExperimentManager& expt_manager = driver.mystruct->expt_manager;
+  expt_manager.SetVerbose(false);
+
+  ParmParse pp;
+  int group_size = 1; pp.query("group_size",group_size);
+  ParallelGroups::Split(group_size);
+  if (ParallelGroups::GroupSize() > 1) {
+    expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_RANK);
+  }
+  else {
+    expt_manager.SetParallelMode(ExperimentManager::PARALLELIZE_OVER_THREAD);
+  }
+
+  ParmParse pps("screen");
+  std::string method = "morris"; pps.query("method",method);
+  int trajectories = 10; pps.query("trajectories",trajectories);
+  int levels = 4; pps.query("levels",levels);
+  int samples = 64; pps.query("samples",samples);
+  Real width = 2; pps.query("width",width);
+  int batch_size = 256; pps.query("batch_size",batch_size);
+  std::string out_file = "screen.dat"; pps.query("out_file",out_file);
+  bool valid_box = false; pps.query("valid_box",valid_box);
+  Real valid_tol = 1.e-3; pps.query("valid_tol",valid_tol);
+  int valid_points = 0; pps.query("valid_points",valid_points);
+  if (method != "morris" && method != "sobol") {
+    BoxLib::Abort("screen.method must be morris or sobol");
+  }
+  if (valid_tol <= 0) {
+    BoxLib::Abort("screen.valid_tol must be positive");
+  }
+  if (trajectories < 1 || levels < 2 || samples < 2 || batch_size < 1) {
+    BoxLib::Abort("screen: trajectories, batch_size must be at least 1, levels, samples at least 2");
+  }
+
+  const std::vector<Real>& prior_mean = parameter_manager.PriorMean();
+  const std::vector<Real>& prior_std = parameter_manager.PriorSTD();
+  const std::vector<Real>& lower_bound = parameter_manager.LowerBound();
+  const std::vector<Real>& upper_bound = parameter_manager.UpperBound();
+  int num_params = prior_mean.size();
+  box_lo.resize(num_params);
+  box_hi.resize(num_params);
+  for (int i=0; i<num_params; ++i) {
+    box_lo[i] = std::max(lower_bound[i], prior_mean[i] - width * prior_std[i]);
+    box_hi[i] = std::min(upper_bound[i], prior_mean[i] + width * prior_std[i]);
+  }
+
+  if (valid_box) {
+    // Search all the parameters at once, the others at the prior mean
+    std::vector<Real> ktyp(num_params);
+    std::vector<int> idx(num_params);
+    Real tol = 0;
+    for (int i=0; i<num_params; ++i) {
+      ktyp[i] = std::min(box_hi[i], std::max(box_lo[i], prior_mean[i]));
+      idx[i] = i;
+      Real w = valid_tol * (box_hi[i] - box_lo[i]);
+      if (w > 0) {
+        tol = (tol > 0 ? std::min(tol,w) : w);
+      }
+    }
+    if (tol > 0) {
+      expt_manager.get_param_limits(box_lo,box_hi,ktyp,tol,ktyp,idx,valid_points);
+      if (ioproc) {
+        std::cout << "Box cut to the valid ranges, searched over "
+                  << ParallelGroups::NGroups() << " groups" << std::endl;
+      }
+    }
+  }
+
+  const std::vector<std::string>& expt_names = expt_manager.ExperimentNames();
+  int num_expts = expt_manager.size();
+  num_outputs = num_expts + 1;
+
+  if (ioproc) {
+    std::cout << "Screening " << num_params << " parameters against "
+              << num_expts << " experiments, method " << method << std::endl;
+  }
+
+  std::vector<Real> meas;
+  int failed = 0;
+  int evaluations;
+  if (method == "morris") {
+    morris(trajectories,levels,batch_size,meas,failed);
+    evaluations = trajectories * (num_params + 1);
+  }
+  else {
+    sobol(samples,batch_size,meas,failed);
+    evaluations = samples * (num_params + 2);
+  }
+
+  // Rank by the first measure of the total
+  std::vector<std::pair<Real,int> > ranking(num_params);
+  for (int i=0; i<num_params; ++i) {
+    ranking[i] = std::make_pair(-meas[((size_t)i*num_outputs + num_expts)*4], i);
+  }
+  std::sort(ranking.begin(),ranking.end());
+  Real largest = (num_params > 0 ? -ranking[0].first : 0);
+
+  if (ioproc) {
+    std::ofstream ofs(out_file.c_str());
+    ofs << "# screenParams 1\n";
+    ofs << "# inputs " << (argc > 1 ? argv[1] : "") << '\n';
+    ofs << "# method " << method;
+    if (method == "morris") {
+      ofs << " trajectories " << trajectories << " levels " << levels;
+    }
+    else {
+      ofs << " samples " << samples;
+    }
+    ofs << " evaluations " << evaluations << " failed " << failed << '\n';
+    for (int i=0; i<num_params; ++i) {
+      ChemDriver::Parameter& param = parameter_manager.active_parameters[i];
+      ofs << "# P" << i << " (R" << param.RxnID() << "): "
+          << Driver::cd->reactionStringBuild(param.RxnID()) << " "
+          << param.GetParamString() << " ["
+          << box_lo[i] << ", " << box_hi[i] << "]\n";
+    }
+    const char* cols = (method == "morris" ? "mu_star mu sigma effects" : "S_total S_first samples");
+    std::string measure = (method == "morris" ? "mu_star" : "S_total");
+    ofs << "# rank param " << cols << " relative";
+    for (int e=0; e<num_expts; ++e) {
+      ofs << " " << measure << "_" << expt_names[e];
+    }
+    ofs << '\n';
+
+    ofs << std::setprecision(6);
+    for (int r=0; r<num_params; ++r) {
+      int i = ranking[r].second;
+      const Real* m = &(meas[((size_t)i*num_outputs + num_expts)*4]);
+      std::ostringstream line;
+      line << std::setprecision(6) << r << " " << i << " " << m[0] << " " << m[1];
+      if (method == "morris") {
+        line << " " << m[2] << " " << int(m[3]);
+      }
+      else {
+        line << " " << int(m[2]);
+      }
+      line << " " << (largest > 0 ? m[0] / largest : 0);
+      ofs << line.str();
+      for (int e=0; e<num_expts; ++e) {
+        ofs << " " << meas[((size_t)i*num_outputs + e)*4];
+      }
+      ofs << '\n';
+      std::cout << line.str() << std::endl;
+    }
+    if (!ofs.good()) {
+      BoxLib::Abort("screenParams: failed to write " + out_file);
+    }
+    std::cout << evaluations << " evaluations, " << failed << " failed; table in "
+              << out_file << std::endl;
+  }
+
+  BoxLib::Finalize();
+
+#ifdef BL_USE_MPI
+  MPI_Finalize();
+#endif
+}